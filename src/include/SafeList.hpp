@@ -1,113 +1,280 @@
 ﻿#pragma once
 
-#include <vector>
-#include <functional>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 // using namespace std;
 
-template <class T>
+// growable array that keeps up to InlineCapacity elements inside the object, a list that stays that small never allocates.
+// accessors return references, a moved from list is empty
+template <class T, size_t InlineCapacity = 0>
 class SafeList
 {
-    vector<T> baseList;
+    T* items;
+    size_t size = 0;
+    size_t capacity = InlineCapacity;
 
-public:
-    explicit SafeList() = default;
+    alignas(T) unsigned char inlineStorage[InlineCapacity > 0 ? InlineCapacity * sizeof(T) : 1];
+
+    T* inlineItems()
+    {
+        return reinterpret_cast<T*>(inlineStorage);
+    }
+
+    bool isInline() const
+    {
+        return items == reinterpret_cast<const T*>(inlineStorage);
+    }
+
+    void releaseStorage()
+    {
+        destroy_n(items, size);
+
+        if (!isInline())
+        {
+            ::operator delete(items, align_val_t(alignof(T)));
+        }
+    }
+
+    void grow(size_t pMinimumCapacity)
+    {
+        size_t newCapacity = max(pMinimumCapacity, max<size_t>(capacity * 2, 4));
+        T* newItems = static_cast<T*>(::operator new(newCapacity * sizeof(T), align_val_t(alignof(T))));
+
+        uninitialized_move_n(items, size, newItems);
+        releaseStorage();
+
+        items = newItems;
+        capacity = newCapacity;
+    }
+
+    // leaves pOther empty, its heap block is taken over when it has one
+    void takeFrom(SafeList& pOther)
+    {
+        if (pOther.isInline())
+        {
+            uninitialized_move_n(pOther.items, pOther.size, items);
+            size = pOther.size;
+            destroy_n(pOther.items, pOther.size);
+        }
+        else
+        {
+            items = pOther.items;
+            size = pOther.size;
+            capacity = pOther.capacity;
+
+            pOther.items = pOther.inlineItems();
+            pOther.capacity = InlineCapacity;
+        }
+
+        pOther.size = 0;
+    }
 
-    explicit SafeList(initializer_list<T> pInitializerList)
+public:
+    SafeList() : items(inlineItems())
     {
-        baseList = vector<T>(pInitializerList);
     }
 
-    template <class Iterable>
-    explicit SafeList(Iterable pIterable) : SafeList(pIterable.begin(), pIterable.end())
+    SafeList(initializer_list<T> pInitializerList) : SafeList(pInitializerList.begin(), pInitializerList.end())
     {
     }
 
     template <class Iterator>
-    explicit SafeList(Iterator pBegin, Iterator pEnd)
+    explicit SafeList(Iterator pBegin, Iterator pEnd) : SafeList()
     {
-        baseList = vector(pBegin, pEnd);
+        for (; pBegin != pEnd; ++pBegin)
+        {
+            add(*pBegin);
+        }
     }
 
-    explicit SafeList(size_t pSz)
+    // pSz value initialized elements
+    explicit SafeList(size_t pSz) : SafeList()
     {
-        baseList = vector<T>(pSz);
+        reserve(pSz);
+        uninitialized_value_construct_n(items, pSz);
+        size = pSz;
     }
 
-    ~SafeList()
+    SafeList(const SafeList& pOther) : SafeList(pOther.begin(), pOther.end())
     {
-        for (size_t i = 0; i < count(); ++i)
+    }
+
+    SafeList(SafeList&& pOther) noexcept : SafeList()
+    {
+        takeFrom(pOther);
+    }
+
+    SafeList& operator=(const SafeList& pOther)
+    {
+        if (this != &pOther)
         {
-            removeAt(i);
+            clear();
+            reserve(pOther.size);
+            uninitialized_copy_n(pOther.items, pOther.size, items);
+            size = pOther.size;
         }
+
+        return *this;
     }
 
-    template <typename F>
-    T find(function<F(T)> pSieve, F pTarget)
+    SafeList& operator=(SafeList&& pOther) noexcept
     {
-        for (T element : baseList)
+        if (this != &pOther)
         {
-            if (pSieve(element) == pTarget)
-            {
-                return element;
-            }
+            releaseStorage();
+
+            items = inlineItems();
+            size = 0;
+            capacity = InlineCapacity;
+
+            takeFrom(pOther);
         }
 
-        return nullptr;
+        return *this;
+    }
+
+    ~SafeList()
+    {
+        releaseStorage();
+    }
+
+    // pointer to the first element matching pSieve, null when there is none
+    template <typename Predicate>
+    T* find(Predicate pSieve)
+    {
+        T* found = find_if(begin(), end(), pSieve);
+        return found == end() ? nullptr : found;
     }
 
-    char* data()
+    T* data()
     {
-        return reinterpret_cast<char*>(baseList.data());
+        return items;
+    }
+
+    const T* data() const
+    {
+        return items;
+    }
+
+    void reserve(size_t pCapacity)
+    {
+        if (pCapacity > capacity)
+        {
+            grow(pCapacity);
+        }
     }
 
     void insert(size_t pIndex, T pElement)
     {
-        baseList.insert(begin() + pIndex, pElement);
+        add(std::move(pElement));
+        std::rotate(begin() + pIndex, end() - 1, end());
+    }
+
+    void add(const T& pElement)
+    {
+        emplace(pElement);
     }
 
-    void add(T pElement)
+    void add(T&& pElement)
     {
-        baseList.push_back(pElement);
+        emplace(std::move(pElement));
+    }
+
+    template <typename... Args>
+    T& emplace(Args&&... pArgs)
+    {
+        if (size == capacity)
+        {
+            // pArgs may refer into this list, build the element before the old storage goes away
+            T element(std::forward<Args>(pArgs)...);
+            grow(size + 1);
+            return *new (items + size++) T(std::move(element));
+        }
+
+        return *new (items + size++) T(std::forward<Args>(pArgs)...);
     }
 
-    size_t index(T pElement)
+    // count() when pElement is not in the list
+    size_t index(const T& pElement) const
     {
-        return std::ranges::find(baseList.begin(), baseList.end(), pElement);
+        return static_cast<size_t>(std::find(begin(), end(), pElement) - begin());
     }
 
     void removeAt(size_t pIdx)
     {
-        baseList.erase(baseList.begin() + pIdx);
+        std::move(begin() + pIdx + 1, end(), begin() + pIdx);
+        destroy_at(items + --size);
+    }
+
+    void removeElement(const T& pElement)
+    {
+        size_t idx = index(pElement);
+        if (idx < size)
+        {
+            removeAt(idx);
+        }
+    }
+
+    void clear()
+    {
+        destroy_n(items, size);
+        size = 0;
+    }
+
+    size_t count() const
+    {
+        return size;
+    }
+
+    bool empty() const
+    {
+        return size == 0;
+    }
+
+    T& at(size_t pIdx)
+    {
+        return items[pIdx];
+    }
+
+    const T& at(size_t pIdx) const
+    {
+        return items[pIdx];
     }
 
-    void removeElement(T pElement)
+    T* begin()
     {
-        removeAt(index(pElement));
+        return items;
     }
 
-    size_t count()
+    T* end()
     {
-        return baseList.size();
+        return items + size;
     }
 
-    T at(size_t pIdx)
+    const T* begin() const
     {
-        return baseList[pIdx];
+        return items;
     }
 
-    typename vector<T>::iterator begin()
+    const T* end() const
     {
-        return baseList.begin();
+        return items + size;
     }
 
-    typename vector<T>::iterator end()
+    T& operator[](size_t pIdx)
     {
-        return baseList.end();
+        return items[pIdx];
     }
 
-    T operator[](size_t pIdx)
+    const T& operator[](size_t pIdx) const
     {
-        return at(pIdx);
+        return items[pIdx];
     }
 };
@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "types.hpp"
+
+namespace SPARK
+{
+    // most lines and label tables fit in the first block, larger requests get a block of their own
+    constexpr size_t SPARK_ARENA_BLOCK_SIZE = 1 << 14;
+
+    // bump allocator, everything allocated from it is released at once by reset or the destructor. objects with a destructor
+    // are destroyed at that point in reverse order of creation. not thread safe, each context has its own
+    typedef class SparkArena
+    {
+        typedef struct SparkArenaBlock
+        {
+            unique_ptr<char[]> memory;
+            size_t size;
+        } SparkArenaBlock;
+
+        typedef struct SparkArenaDestructor
+        {
+            void (*destroy)(void*);
+            void* object;
+            SparkArenaDestructor* next;
+        } SparkArenaDestructor;
+
+        vector<SparkArenaBlock> blocks;
+        uintptr_t cursor = 0;
+        uintptr_t limit = 0;
+
+        SparkArenaDestructor* destructors = nullptr;
+
+        static uintptr_t alignUp(uintptr_t pAddress, size_t pAlignment)
+        {
+            return (pAddress + pAlignment - 1) & ~(static_cast<uintptr_t>(pAlignment) - 1);
+        }
+
+        void addBlock(size_t pMinimumSize)
+        {
+            size_t size = max(pMinimumSize, SPARK_ARENA_BLOCK_SIZE);
+            blocks.push_back({make_unique_for_overwrite<char[]>(size), size});
+
+            cursor = reinterpret_cast<uintptr_t>(blocks.back().memory.get());
+            limit = cursor + size;
+        }
+
+        void destroyObjects()
+        {
+            for (SparkArenaDestructor* destructor = destructors; destructor; destructor = destructor->next)
+            {
+                destructor->destroy(destructor->object);
+            }
+
+            destructors = nullptr;
+        }
+
+    public:
+        SparkArena() = default;
+
+        ~SparkArena()
+        {
+            destroyObjects();
+        }
+
+        SparkArena(const SparkArena&) = delete;
+        SparkArena& operator=(const SparkArena&) = delete;
+
+        void* allocate(size_t pSize, size_t pAlignment)
+        {
+            uintptr_t aligned = alignUp(cursor, pAlignment);
+
+            if (blocks.empty() || aligned + pSize > limit)
+            {
+                addBlock(pSize + pAlignment);
+                aligned = alignUp(cursor, pAlignment);
+            }
+
+            cursor = aligned + pSize;
+            return reinterpret_cast<void*>(aligned);
+        }
+
+        template <typename T, typename... Args>
+        T* create(Args&&... pArgs)
+        {
+            T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(pArgs)...);
+
+            if constexpr (!is_trivially_destructible_v<T>)
+            {
+                auto destroy = [](void* pObject)
+                {
+                    static_cast<T*>(pObject)->~T();
+                };
+
+                destructors = new (allocate(sizeof(SparkArenaDestructor), alignof(SparkArenaDestructor))) SparkArenaDestructor{destroy, object, destructors};
+            }
+
+            return object;
+        }
+
+        // value initialized, only for types that need no destructor
+        template <typename T>
+        span<T> allocateArray(size_t pCount)
+        {
+            static_assert(is_trivially_destructible_v<T>, "arena arrays are never destroyed");
+
+            T* first = static_cast<T*>(allocate(sizeof(T) * pCount, alignof(T)));
+            uninitialized_value_construct_n(first, pCount);
+
+            return {first, pCount};
+        }
+
+        template <typename T>
+        span<T> copyArray(span<const T> pValues)
+        {
+            span<T> copy = allocateArray<T>(pValues.size());
+            std::copy(pValues.begin(), pValues.end(), copy.begin());
+
+            return copy;
+        }
+
+        // destroys everything and keeps the first block for what comes next
+        void reset()
+        {
+            destroyObjects();
+
+            if (blocks.empty())
+            {
+                return;
+            }
+
+            blocks.resize(1);
+            cursor = reinterpret_cast<uintptr_t>(blocks[0].memory.get());
+            limit = cursor + blocks[0].size;
+        }
+    } SparkArena;
+}
@@ -1,39 +1,45 @@
 ﻿#pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <filesystem>
+#include <span>
 #include <types.hpp>
 #include <utility>
+#include <vector>
 
 #include "cpu.hpp"
+#include "ir.hpp"
+#include "isa.hpp"
+#include "lexer.hpp"
 #include "SafeList.hpp"
+#include "source.hpp"
+#include "threadPool.hpp"
 #include "log.hpp"
 
 using namespace std;
 
 namespace SPARK::Assembler::Analysis
 {
-    bool humanChar(unsigned char pChar)
+    int stringToInt(Cpu::SparkAssemblerContext* pCtx, string_view pStr, int pBase = 10)
     {
-        return pChar >= 0x20 && pChar <= 0x82;
-    }
+        int value = 0;
+        const char* end = pStr.data() + pStr.size();
 
-    int stringToInt(Cpu::SparkAssemblerContext* pCtx, const string& pStr, size_t* pOffset = nullptr, int pBase = 10)
-    {
-        try
-        {
-            return stoi(pStr, pOffset, pBase);
-        }
-        catch (...)
+        auto [parsedEnd, errorCode] = from_chars(pStr.data(), end, value, pBase);
+        if (errorCode != errc() || parsedEnd != end)
         {
             pCtx->error(format("Could not convert string '{0}' to integer.\n", pStr));
             return -1;
         }
+
+        return value;
     }
 
-    Reg stringToOperandValue(Cpu::SparkAssemblerContext* pCtx, const std::string& pString)
+    Reg stringToOperandValue(Cpu::SparkAssemblerContext* pCtx, string_view pString)
     {
         int base = 10;
-        int offset = 0;
 
         Cpu::ESparkExternalRegister regVal = Cpu::stringRegisterToRegisterValue(pString);
         if (regVal != Cpu::INVREG)
@@ -41,153 +47,78 @@ namespace SPARK::Assembler::Analysis
             return regVal;
         }
 
-        if (pString.contains("0x"))
+        bool negative = pString.starts_with('-');
+        if (negative)
         {
-            base = 16;
-            offset = 2;
+            pString.remove_prefix(1);
         }
 
-        if (pString.contains("0b"))
+        if (pString.starts_with("0x"))
+        {
+            base = 16;
+            pString.remove_prefix(2);
+        }
+        else if (pString.starts_with("0b"))
         {
             base = 2;
-            offset = 2;
+            pString.remove_prefix(2);
         }
 
-        string toInt = pString.substr(offset, pString.length() - offset);
-        return stringToInt(pCtx, toInt, nullptr, base);
+        int value = stringToInt(pCtx, pString, base);
+        return negative ? -value : value;
     }
 
-    string operandValueToString(Reg pValue, Cpu::ESparkOperandType pOperandType, size_t pBitLength)
+    const Lexer::SparkLineTokens& currentTokens(Cpu::SparkAssemblerContext* pCtx)
     {
-        string operandStr;
-
-        switch (pOperandType)
-        {
-        case Cpu::REGISTER:
-            {
-                operandStr = Cpu::gRegisterNameTable[pValue];
-            }
-            break;
-
-        case Cpu::IMMEDIATE:
-            {
-                switch (pBitLength)
-                {
-                case 1:
-                    {
-                        operandStr = format("0x{0:X}", pValue);
-                    }
-                    break;
-                case 8:
-                    {
-                        string prefix;
-                        auto valueSigned = static_cast<int8_t>(pValue);
-                        if (valueSigned < 0)
-                        {
-                            valueSigned = -valueSigned;
-                            prefix = "-";
-                        }
-                        operandStr = format("{0}0x{1:X}", prefix, valueSigned);
-                    }
-                    break;
-                case 16:
-                    {
-                        string prefix;
-                        auto valueSigned = static_cast<int8_t>(pValue);
-                        if (valueSigned < 0)
-                        {
-                            valueSigned = -valueSigned;
-                            prefix = "-";
-                        }
-                        operandStr = format("{0}0x{1:X}", prefix, valueSigned);
-                    }
-                    break;
-                case 32:
-                    {
-                        string prefix;
-                        auto valueSigned = static_cast<int8_t>(pValue);
-                        if (valueSigned < 0)
-                        {
-                            valueSigned = -valueSigned;
-                            prefix = "-";
-                        }
-                        operandStr = format("{0}0x{1:X}", prefix, valueSigned);
-                    }
-                    break;
-                default:
-                    {
-                        LOGWRN("The immediate 0x{0:X} has a bit length of {1}, which is not supported (8, 16, 32).\n", pValue, pBitLength);
-                    }
-                    break;
-                }
-            }
-            break;
-        }
-
-        return operandStr;
+        return pCtx->currentLine.tokens;
     }
 
     bool currentAssemblyLineHasLabel(Cpu::SparkAssemblerContext* pCtx)
     {
-        return static_cast<int>(pCtx->currentLine->cleanLineContentsPtr->find(':')) > 0;
+        return currentTokens(pCtx).leadingKind() == Lexer::LABEL_NAME;
     }
 
     void parseLabelFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx)
     {
-        string cleanLine = *pCtx->currentLine->cleanLineContentsPtr;
+        if (!pCtx->addLabel(static_cast<Reg>(pCtx->currentLine.cpuLineNumber * 4), currentTokens(pCtx)[0].text))
+        {
+            return;
+        }
 
-        int idx = cleanLine.find(':');
-        string labelName = cleanLine.substr(0, idx);
-        pCtx->labels.add(new Cpu::SparkAssemblerLabel(*pCtx->currentLine->cpuLineNumberPtr * 4, labelName));
+        pCtx->success();
     }
 
     bool currentAssemblyLineHasInclude(Cpu::SparkAssemblerContext* pCtx)
     {
-        return pCtx->currentLine->cleanLineContentsPtr->starts_with("#include ");
+        return currentTokens(pCtx).hasDirective("#include");
     }
 
     bool currentAssemblyLineHasIncludePath(Cpu::SparkAssemblerContext* pCtx)
     {
-        return pCtx->currentLine->cleanLineContentsPtr->starts_with("#includePath");
+        return currentTokens(pCtx).hasDirective("#includePath");
     }
 
-    bool isValidStringRegister(const string& pRegisterStr)
+    bool currentAssemblyLineHasPragmaOnce(Cpu::SparkAssemblerContext* pCtx)
     {
-        return std::ranges::any_of(Cpu::gRegisterNameTable, [pRegisterStr](const string& pX) { return pX == pRegisterStr; });
+        return currentTokens(pCtx).isPragmaOnce();
     }
 
-    bool currentAssemblyLineHasRegisterMacro(Cpu::SparkAssemblerContext* pCtx)
+    bool isValidStringRegister(string_view pRegisterStr)
     {
-        string cleanLine = *pCtx->currentLine->cleanLineContentsPtr;
-        int equalsSignIndex = cleanLine.find('=');
-
-        if (equalsSignIndex <= 0)
-        {
-            return false;
-        }
-
-        if (std::ranges::count(cleanLine, '=') != 1)
-        {
-            return false;
-        }
-
-        string registerStr = cleanLine.substr(equalsSignIndex + 1);
-
-        if (!isValidStringRegister(registerStr))
-        {
-            return false;
-        }
+        return Cpu::stringRegisterToRegisterValue(pRegisterStr) != Cpu::INVREG;
+    }
 
-        return true;
+    bool currentAssemblyLineHasRegisterMacro(Cpu::SparkAssemblerContext* pCtx)
+    {
+        return currentTokens(pCtx).leadingKind() == Lexer::MACRO_NAME;
     }
 
     void parseRegisterMacroFromCurrentLine(Cpu::SparkAssemblerContext* pCtx)
     {
-        string cleanLine = *pCtx->currentLine->cleanLineContentsPtr;
-        int equalsSignIndex = cleanLine.find('=');
+        const Lexer::SparkLineTokens& tokens = currentTokens(pCtx);
 
-        string registerStr = cleanLine.substr(equalsSignIndex + 1);
-        string representation = cleanLine.substr(0, equalsSignIndex);
+        string_view representation = tokens[0].text;
+        string_view registerStr = tokens[1].text;
 
         pCtx->setRegisterMacro(representation, Cpu::stringRegisterToRegisterValue(registerStr));
 
@@ -195,6 +126,8 @@ namespace SPARK::Assembler::Analysis
         {
             return;
         }
+
+        pCtx->success();
     }
 
     enum EAssemblyLineType
@@ -204,211 +137,83 @@ namespace SPARK::Assembler::Analysis
         EXECUTABLE,
         LABEL,
         REGISTER_MACRO,
+        DIRECTIVE,
     };
 
     EAssemblyLineType getCurrentLineType(Cpu::SparkAssemblerContext* pCtx)
     {
-        string lineClean = *pCtx->currentLine->cleanLineContentsPtr;
-
-        if (currentAssemblyLineHasLabel(pCtx))
+        switch (currentTokens(pCtx).leadingKind())
         {
+        case Lexer::INV_TOKEN:
+            return EMPTY;
+        case Lexer::LABEL_NAME:
             return LABEL;
-        }
-
-        if (currentAssemblyLineHasRegisterMacro(pCtx))
-        {
+        case Lexer::MACRO_NAME:
             return REGISTER_MACRO;
+        case Lexer::DIRECTIVE:
+            return DIRECTIVE;
+        case Lexer::MNEMONIC:
+            return EXECUTABLE;
+        default:
+            return INV_LINE_TYPE;
         }
-
-        return EXECUTABLE;
-    }
-
-
-    string cleanupAssemblyLine(const string& pLine)
-    {
-        string tempLine = pLine;
-        int off = pLine.find(';');
-
-        if (off != -1)
-        {
-            tempLine = pLine.substr(0, off);
-        }
-
-        SafeList<char> trimmed(tempLine);
-
-        size_t index = 0;
-        size_t spaceCount = 0;
-
-        char previousChar = '\0';
-
-        while (true)
-        {
-            char nextChar;
-            if (index == 1 && trimmed.count() == 1)
-            {
-                return "";
-            }
-
-            if (index >= trimmed.count())
-            {
-                break;
-            }
-
-            if (index > 0)
-            {
-                previousChar = trimmed[index - 1];
-            }
-
-            if (index < trimmed.count() - 1)
-            {
-                nextChar = trimmed[index + 1];
-            }
-            else
-            {
-                nextChar = '\0';
-            }
-
-            if (trimmed[0] == ' ')
-            {
-                trimmed.removeAt(0);
-                continue;
-            }
-
-            char currentChar = trimmed[index];
-
-            if (currentChar == ',' && nextChar == ' ')
-            {
-                trimmed.removeAt(index + 1);
-                continue;
-            }
-            
-            if (currentChar == ' ')
-            {
-                spaceCount++;
-
-                if (previousChar == ' ')
-                {
-                    trimmed.removeAt(index);
-                    continue;
-                }
-
-                if (nextChar == '=')
-                {
-                    trimmed.removeAt(index);
-                    continue;
-                }
-
-                if (previousChar == '=')
-                {
-                    trimmed.removeAt(index);
-                    continue;
-                }
-
-                if (index + 1 == trimmed.count() - 1)
-                {
-                    trimmed.removeAt(index);
-                    continue;
-                }
-            }
-            if (!humanChar(currentChar))
-            {
-                trimmed.removeAt(index);
-                continue;
-            }
-
-            index++;
-        }
-
-        return {
-            trimmed.begin(),
-            trimmed.end()
-        };
     }
 
-
-    void getOpcodeFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx, string* pOpcodeOut)
+    void getOpcodeFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx, string_view* pOpcodeOut)
     {
-        Cpu::AssemblyLine* line = pCtx->currentLine;
+        const Lexer::SparkLineTokens& tokens = currentTokens(pCtx);
 
-        if (!line)
+        if (tokens.leadingKind() != Lexer::MNEMONIC || tokens[0].text.empty())
         {
-            pCtx->error("pCtx->currentLine was null.\n");
+            pCtx->error(format("No opcode found in line '{0}'.\n", pCtx->currentLine.rawLineContents));
             return;
         }
 
-        string* cleanLineStr = line->cleanLineContentsPtr;
-
-        if (!cleanLineStr->contains(' '))
-        {
-            *pOpcodeOut = *cleanLineStr;
-            pCtx->success();
-            return;
-        }
-
-        for (size_t i = 0; i < cleanLineStr->size(); i++)
-        {
-            char currentChar = cleanLineStr->at(i);
-
-            if (currentChar == ' ')
-            {
-                *pOpcodeOut = cleanLineStr->substr(0, i);
-                return;
-            }
-        }
-
-        pCtx->error(format("No opcode found in line '{0}'.\n", *line->rawLineContentsPtr));
+        *pOpcodeOut = tokens[0].text;
+        pCtx->success();
     }
 
     size_t getOperandCountFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx)
     {
-        string cleanLineContents = *pCtx->currentLine->cleanLineContentsPtr;
+        const Lexer::SparkLineTokens& tokens = currentTokens(pCtx);
 
-        bool hasSpace = static_cast<int>(cleanLineContents.find(' ')) > 0;
-        if (!hasSpace)
+        if (tokens.leadingKind() != Lexer::MNEMONIC)
         {
             return 0;
         }
 
-        return 1 + std::ranges::count(cleanLineContents, ',');
+        return tokens.count - 1;
     }
 
-    void getOperandsFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx, SafeList<Reg>* pOutOperands, SafeList<string>* pRawOperands)
+    // both arrays are allocated in the arena of pCtx, quoted operands only show up in pRawOperands
+    void getOperandsFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx, span<Reg>* pOutOperands, span<string_view>* pRawOperands)
     {
-        string cleanLine = *pCtx->currentLine->cleanLineContentsPtr;
-        int spaceOffset = cleanLine.find(' ') + 1;
+        const Lexer::SparkLineTokens& tokens = currentTokens(pCtx);
+
+        if (tokens.overflow)
+        {
+            pCtx->error(format("Too many operands, at most {0} tokens are allowed per line.\n", Lexer::SPARK_MAX_LINE_TOKENS));
+            return;
+        }
 
         size_t operandCount = getOperandCountFromCurrentAssemblyLine(pCtx);
 
-        size_t commaOffset = 0;
-        for (size_t i = 0; i < operandCount; i++)
+        span<Reg> operands = pCtx->arena.allocateArray<Reg>(operandCount);
+        span<string_view> rawOperands = pCtx->arena.allocateArray<string_view>(operandCount);
+        size_t valueCount = 0;
+
+        for (size_t i = 1; i <= operandCount; i++)
         {
-            string operandsStr = cleanLine.substr(spaceOffset);
+            const Lexer::SparkToken& token = tokens[i];
+            string_view rawOperand = token.text;
 
-            int newCommaOffset = operandsStr.find(',', commaOffset + 1);
+            rawOperands[i - 1] = rawOperand;
 
-            if (commaOffset != 0)
+            if (token.kind == Lexer::QUOTED_OPERAND)
             {
-                commaOffset++;
-            }
-            string rawOperand = operandsStr.substr(commaOffset, newCommaOffset == -1 ? string::npos : newCommaOffset - commaOffset);
-
-            if (rawOperand.contains('\''))
-            {
-                pRawOperands->add(rawOperand.substr(1, rawOperand.size() - 2));
                 continue;
             }
 
-            if (newCommaOffset > 0)
-            {
-                commaOffset = newCommaOffset;
-            }
-            else
-            {
-                commaOffset += rawOperand.size();
-            }
-
-            pRawOperands->add(rawOperand);
-
             Reg operandValue;
             if (pCtx->registerMacroExists(rawOperand))
             {
@@ -424,22 +229,22 @@ namespace SPARK::Assembler::Analysis
                 return;
             }
 
-            pOutOperands->add(operandValue);
+            operands[valueCount++] = operandValue;
         }
+
+        *pOutOperands = operands.first(valueCount);
+        *pRawOperands = rawOperands;
     }
 
 
     void parseInstructionFromCurrentAssemblyLine(Cpu::SparkAssemblerContext* pCtx, Cpu::SparkInstructionInstance** pOutInstructionInstance)
     {
-        string opcodeStr;
-        string currentPart;
-
-        SafeList<Reg> operands;
-        SafeList<string> rawOperands;
+        string_view opcodeStr;
 
-        string lineContents = *pCtx->currentLine->cleanLineContentsPtr;
+        span<Reg> operands;
+        span<string_view> rawOperands;
 
-        if (lineContents.empty())
+        if (currentTokens(pCtx).empty())
         {
             pCtx->ignore("The line is too short.");
             return;
@@ -467,11 +272,28 @@ namespace SPARK::Assembler::Analysis
 
             if (macroOpcodeId != Cpu::INVMACRO)
             {
-                Cpu::SparkInstructionMacroType* macroType = getMacroTypeFromId(macroOpcodeId);
-                Cpu::ESparkInstructionOpcodeId baseOpcodeId = macroType->baseOpcodeId;
+                const Cpu::SparkInstructionMacroType* macroType = Cpu::getMacroTypeFromId(macroOpcodeId);
+                const Cpu::SparkInstructionType* baseType = Cpu::getInstructionTypeFromOpcodeId(macroType->baseOpcodeId);
+
+                // the expander indexes the operands as written without looking at how many there are, label operands included
+                if (rawOperands.size() != macroType->operandCount)
+                {
+                    pCtx->error(format("The number of provided operands ({0}) is not equal to the expected number of operands ({1}).", rawOperands.size(), macroType->operandCount));
+                    return;
+                }
+
+                // the expander reads the operands as written through currentInstruction
+                pCtx->currentInstruction = pCtx->arena.create<Cpu::SparkInstructionInstance>(baseType, operands, rawOperands);
+
+                Cpu::SparkOperandList expanded;
+                {
+                    Stats::SparkPhaseScope expanding(&pCtx->phases, Stats::PHASE_MACRO);
+                    expanded = macroType->parserFunction(pCtx);
+                }
+                span<Reg> expandedOperands = pCtx->arena.allocateArray<Reg>(expanded.count());
+                std::copy(expanded.begin(), expanded.end(), expandedOperands.begin());
 
-                pCtx->currentInstruction = new Cpu::SparkInstructionInstance(baseOpcodeId, operands, rawOperands);
-                *pOutInstructionInstance = new Cpu::SparkInstructionInstance(baseOpcodeId, macroType->parserFunction(pCtx), rawOperands);
+                *pOutInstructionInstance = pCtx->arena.create<Cpu::SparkInstructionInstance>(baseType, expandedOperands, rawOperands);
 
                 pCtx->success();
                 return;
@@ -482,158 +304,407 @@ namespace SPARK::Assembler::Analysis
         }
 
         pCtx->success();
-        *pOutInstructionInstance = new Cpu::SparkInstructionInstance(opcodeId, operands, rawOperands);
+        *pOutInstructionInstance = pCtx->arena.create<Cpu::SparkInstructionInstance>(Cpu::getInstructionTypeFromOpcodeId(opcodeId), operands, rawOperands);
     }
 
-    string getIncludeFileName(const string& pCleanLine)
+    string getIncludeFileName(const Lexer::SparkLineTokens& pTokens)
     {
-        string fileName = pCleanLine.substr(pCleanLine.find('\''));
-        fileName = fileName.substr(1, fileName.size() - 2);
-        return fileName;
+        return string(pTokens.directiveArgument());
     }
 
-    string getIncludePathName(const string& pCleanLine)
+    string getIncludePathName(const Lexer::SparkLineTokens& pTokens)
     {
-        return getIncludeFileName(pCleanLine);
+        return getIncludeFileName(pTokens);
     }
 
-    void expandRawIncludeRecursively(Cpu::SparkAssemblerContext* pCtx, const string& pFileName, SafeList<string>* pOutLines)
+    // include paths are searched in the order they were added, a name found in none of them is opened as given
+    string resolveIncludePath(Cpu::SparkAssemblerContext* pCtx, Source::SparkSourceManager* pSources, const string& pName)
     {
-        std::ifstream file(pFileName);
+        // the manager may be shared by assemblies with different include paths and working directories, so all of them are part of the key
+        string key = pName + '\n' + pCtx->workingDirectory.generic_string();
+        for (const string& includePath : pCtx->absoluteIncludePaths)
+        {
+            key += '\n';
+            key += includePath;
+        }
 
-        string line;
+        string finalPath;
+        bool cached = pSources->findResolvedInclude(key, &finalPath);
 
-        pCtx->setCurrentFile(pFileName);
+        if (pCtx->stats)
+        {
+            pCtx->stats->includeLookups++;
+            pCtx->stats->includeCacheHits += cached ? 1 : 0;
+        }
 
-        while (std::getline(file, line))
+        if (cached)
         {
-            pCtx->incrementAssemblerLineNumber();
+            pCtx->success();
+            return finalPath;
+        }
 
-            string cleanLine = cleanupAssemblyLine(line);
-            if (cleanLine.contains("#include "))
+        string conflicts;
+        size_t foundMatches = 0;
+
+        for (const string& includePath : pCtx->absoluteIncludePaths)
+        {
+            Source::SparkFileStatus status = pSources->status((std::filesystem::path(includePath) / pName).generic_string());
+
+            // the same file reached through two include paths is not a conflict
+            if (!status.exists || status.canonicalPath == finalPath)
+            {
+                continue;
+            }
+
+            foundMatches++;
+
+            if (foundMatches > 1)
             {
-                string fileName = getIncludeFileName(cleanLine);
-                expandRawIncludeRecursively(pCtx, fileName, pOutLines);
+                conflicts += ", " + status.canonicalPath;
+                continue;
+            }
+
+            finalPath = status.canonicalPath;
+        }
+
+        if (foundMatches > 1)
+        {
+            pCtx->error(format("Found conflicts in include path '{0}': {1}{2}.\n", pName, finalPath, conflicts));
+            return "";
+        }
+
+        if (foundMatches == 0)
+        {
+            finalPath = (pCtx->workingDirectory / pName).generic_string();
+        }
+
+        pSources->addResolvedInclude(key, finalPath);
+
+        pCtx->success();
+        return finalPath;
+    }
+
+    // appends the lines of pFileName to pOutProgram with nested includes spliced in place. on failure the context
+    // current file, line number and line contents point at the include directive that failed
+    void expandRawIncludeRecursively(Cpu::SparkAssemblerContext* pCtx, Source::SparkSourceManager* pSources, const string& pFileName, Source::SparkSegmentList* pOutProgram)
+    {
+        // nested includes show up as nested spans
+        Trace::SparkTraceScope span(pCtx->trace, "include", pFileName);
+
+        string resolvedPath = resolveIncludePath(pCtx, pSources, pFileName);
+
+        if (pCtx->isError())
+        {
+            return;
+        }
+
+        uint32_t fileId = pSources->load(resolvedPath);
+
+        if (fileId == Source::SPARK_INVALID_FILE_ID)
+        {
+            pCtx->error(format("Could not open included file '{0}'.\n", pFileName));
+            return;
+        }
+
+        if (pCtx->stats)
+        {
+            pCtx->stats->includeFiles++;
+        }
+
+        {
+            Stats::SparkPhaseScope lexing(&pCtx->phases, Stats::PHASE_LEX);
+            pSources->cacheTokens(fileId);
+        }
+
+        // the program keeps one use per included file, released along with it
+        bool firstInclude = pOutProgram->markIncluded(fileId);
+        if (!firstInclude)
+        {
+            pSources->release(fileId);
+        }
+
+        if (!firstInclude && pSources->isPragmaOnce(fileId))
+        {
+            pCtx->success();
+            return;
+        }
+
+        // the context still points at the directive that included the file
+        if (!pOutProgram->beginExpansion(fileId))
+        {
+            pCtx->error(format("Recursive include of '{0}'.\n", pFileName));
+            return;
+        }
+
+        Lexer::SparkLineTokens tokens;
+        uint32_t runStart = 0;
+
+        for (const Source::SparkSourceLine& line : pSources->lines(fileId))
+        {
+            pSources->lineTokens(line, &tokens);
+
+            bool include = tokens.hasDirective("#include");
+            bool includePath = tokens.hasDirective("#includePath");
+
+            if (!include && !includePath && !tokens.isPragmaOnce())
+            {
+                continue;
+            }
+
+            // the lines up to the directive stay in the file, only the directive itself is left out
+            pOutProgram->append(fileId, runStart, line.lineIndex - runStart);
+            runStart = line.lineIndex + 1;
+
+            pCtx->setCurrentFile(pSources->path(fileId));
+            pCtx->currentLine.assemblerLineNumber = line.lineIndex + 1;
+            pCtx->currentLine.rawLineContents = pSources->lineText(line);
+
+            if (include)
+            {
+                expandRawIncludeRecursively(pCtx, pSources, getIncludeFileName(tokens), pOutProgram);
 
                 if (pCtx->isError())
                 {
+                    pOutProgram->endExpansion();
                     return;
                 }
-
-                break;
             }
-            if (cleanLine.contains("#includePath"))
+            else if (includePath)
             {
-                pCtx->addIncludePath(getIncludePathName(cleanLine));
-                continue;
+                pCtx->addIncludePath(getIncludePathName(tokens));
             }
-
-            pOutLines->insert(0, line);
         }
+
+        pOutProgram->append(fileId, runStart, static_cast<uint32_t>(pSources->lines(fileId).size()) - runStart);
+        pOutProgram->endExpansion();
+        pCtx->success();
     }
 
-    void expandCurrentIncludeRecursively(Cpu::SparkAssemblerContext* pCtx, SafeList<string>* pOutLines)
+    void expandCurrentIncludeRecursively(Cpu::SparkAssemblerContext* pCtx, Source::SparkSourceManager* pSources, Source::SparkSegmentList* pOutProgram)
     {
-        string includeFileName = getIncludeFileName(*pCtx->currentLine->rawLineContentsPtr);
+        string includeFileName = getIncludeFileName(currentTokens(pCtx));
 
-        expandRawIncludeRecursively(pCtx, includeFileName, pOutLines);
+        expandRawIncludeRecursively(pCtx, pSources, includeFileName, pOutProgram);
     }
 }
 
 namespace SPARK::Assembler
 {
-    Reg assembleOperands(SafeList<size_t>* pOperandBitLengths, SafeList<Reg>* pOperandValues, Cpu::SparkAssemblerContext* pCtx)
+    // writes pInstruction into row pRow of pIR, the operands have to match its type
+    void lowerInstruction(Cpu::SparkInstructionInstance* pInstruction, Cpu::SparkAssemblerContext* pCtx, IR::SparkProgramIR* pIR, size_t pRow)
     {
-        Reg customData = 0;
-        size_t position = 6;
+        const Cpu::SparkInstructionType* instructionType = pInstruction->base;
+        span<Reg> operandValues = pInstruction->getOperandValues();
 
-        if (pOperandBitLengths->count() != pOperandValues->count())
+        if (instructionType->operandCount != operandValues.size())
         {
-            pCtx->error(format("The number of provided operands ({0}) is not equal to the expected number of operands ({1}).", pOperandValues->count(), pOperandBitLengths->count()));
-
-            return 0;
+            pCtx->error(format("The number of provided operands ({0}) is not equal to the expected number of operands ({1}).", operandValues.size(), instructionType->operandCount));
+            return;
         }
 
-        for (size_t i = 0; i < pOperandBitLengths->count(); i++)
+        pIR->opcodes[pRow] = static_cast<uint8_t>(instructionType->opcodeId);
+
+        for (size_t i = 0; i < operandValues.size(); i++)
         {
-            Reg value = pOperandValues->at(i);
-            size_t bitLength = pOperandBitLengths->at(i);
+            pIR->operands[i][pRow] = operandValues[i];
+        }
 
-            customData |= value << 32 - bitLength - position;
-            position += bitLength;
+        pCtx->success();
+    }
+
+    // pWords are in host byte order, used by the linker once the words of an object are encoded
+    void patchFixup(Cpu::SparkAssemblerContext* pCtx, const Cpu::SparkAssemblerFixup& pFixup, Reg* pWords)
+    {
+        Cpu::SparkAssemblerLabel* label = pCtx->findLabel(pFixup.labelName);
+        if (!label)
+        {
+            pCtx->error(format("Unresolved label '{0}'.\n", pFixup.labelName));
+            return;
         }
 
+        Reg value = (label->offset - pFixup.instructionOffset) & pFixup.fieldMask;
+        Reg& word = pWords[pFixup.wordIndex];
+
+        word &= ~(pFixup.fieldMask << pFixup.fieldShift);
+        word |= value << pFixup.fieldShift;
+
         pCtx->success();
+    }
+
+    constexpr size_t SPARK_PARSE_CHUNK_LINES = 1 << 12;
+
+    // lines lexed between two reads of the phase clock, reading it twice per line costs more than lexing the line
+    constexpr size_t SPARK_LEX_RUN_LINES = 64;
 
-        return customData;
+    // tokens of line pIndex of pLines. with pClock running the lines are lexed a run at a time into pRunTokens, which holds
+    // SPARK_LEX_RUN_LINES entries, otherwise straight into pOutTokens
+    void lexLine(Stats::SparkPhaseClock* pClock, Source::SparkSourceManager* pSources, span<const Source::SparkSourceLine> pLines, size_t pIndex, Lexer::SparkLineTokens* pRunTokens, Lexer::SparkLineTokens* pOutTokens)
+    {
+        if (!pClock->enabled())
+        {
+            pSources->lineTokens(pLines[pIndex], pOutTokens);
+            return;
+        }
+
+        size_t runIndex = pIndex % SPARK_LEX_RUN_LINES;
+        if (runIndex == 0)
+        {
+            Stats::SparkPhaseScope lexing(pClock, Stats::PHASE_LEX);
+
+            for (size_t i = pIndex; i < min(pIndex + SPARK_LEX_RUN_LINES, pLines.size()); i++)
+            {
+                pSources->lineTokens(pLines[i], &pRunTokens[i - pIndex]);
+            }
+        }
+
+        *pOutTokens = pRunTokens[runIndex];
     }
 
-    string disasemble(Reg pAssembled, Cpu::SparkAssemblerContext* pCtx)
+    enum ESparkDiagnosticSeverity
     {
-        string line;
+        DIAGNOSTIC_ERROR,
+        DIAGNOSTIC_WARNING,
+    };
 
-        auto opcodeId = static_cast<Cpu::ESparkInstructionOpcodeId>((pAssembled & 0b111111 << 26) >> 26);
-        Cpu::SparkInstructionType* instructionType = getInstructionTypeFromOpcodeId(opcodeId);
+    typedef struct SparkDiagnostic
+    {
+        string file;
+        size_t lineNumber;
+        string lineContents;
+        string reason;
+        ESparkDiagnosticSeverity severity = DIAGNOSTIC_ERROR;
+    } SparkDiagnostic;
+
+    // result of one chunk of lines, a chunk stops at its first failing line
+    typedef struct SparkParseChunk
+    {
+        bool failed = false;
+        SparkDiagnostic error;
+        vector<Cpu::SparkAssemblerFixup> fixups;
+    } SparkParseChunk;
 
-        if (instructionType == nullptr)
+    void parseChunk(Cpu::SparkAssemblerContext* pCtx, Source::SparkSourceManager* pSources, span<const Source::SparkSourceLine> pLines, size_t pFirstWordIndex, IR::SparkProgramIR* pOutIR, SparkParseChunk* pOutChunk)
+    {
+        Cpu::SparkAssemblerContext worker(pCtx);
+        Cpu::AssemblyLine& current = worker.currentLine;
+        uint32_t currentFileId = Source::SPARK_INVALID_FILE_ID;
+        array<Lexer::SparkLineTokens, SPARK_LEX_RUN_LINES> runTokens;
+
+        // the time of a chunk is added to the totals when the worker goes away
+        worker.phases.enter(Stats::PHASE_PARSE);
+
+        for (size_t i = 0; i < pLines.size(); i++)
         {
-            pCtx->error(format("No instruction type structure was found under opcode '{0}' (binary '{1:06B}') extracted from assembled instruction '{2:08X}'.", static_cast<Reg>(opcodeId), static_cast<Reg>(opcodeId), pAssembled));
-            return "";
+            const Source::SparkSourceLine& line = pLines[i];
+
+            if (line.fileId != currentFileId)
+            {
+                currentFileId = line.fileId;
+                worker.setCurrentFile(pSources->path(currentFileId));
+            }
+
+            current.cpuLineNumber = pFirstWordIndex + i + 1;
+            current.assemblerLineNumber = line.lineIndex + 1;
+            current.rawLineContents = pSources->lineText(line);
+
+            lexLine(&worker.phases, pSources, pLines, i, runTokens.data(), &current.tokens);
+
+            size_t row = pFirstWordIndex + i;
+            size_t fixupCount = worker.fixups.count();
+
+            Cpu::SparkInstructionInstance* parsed;
+            Analysis::parseInstructionFromCurrentAssemblyLine(&worker, &parsed);
+
+            if (worker.isSuccessful())
+            {
+                lowerInstruction(parsed, &worker, pOutIR, row);
+            }
+
+            // only the macro path sets currentInstruction
+            uint8_t flags = worker.currentInstruction ? IR::INSTRUCTION_MACRO : IR::INSTRUCTION_NONE;
+            if (worker.fixups.count() != fixupCount)
+            {
+                flags |= IR::INSTRUCTION_LABEL_OPERAND;
+            }
+
+            // the instance and its operands are dead once the row is written, the next line reuses the memory
+            worker.currentInstruction = nullptr;
+            worker.arena.reset();
+
+            if (!worker.isSuccessful())
+            {
+                pOutChunk->failed = true;
+                pOutChunk->error = {worker.currentFile.string(), current.assemblerLineNumber, string(current.rawLineContents), worker.getReason()};
+                return;
+            }
+
+            pOutIR->flags[row] = flags;
         }
 
-        line = getOpcodeStrFromOpcodeId(opcodeId);
+        pOutChunk->fixups.assign(worker.fixups.begin(), worker.fixups.end());
+    }
+
+    // parses every line into a row of pOutIR, a line's row is its position in pLines. chunks of lines run on pPool (may be null)
+    // with their own error and line state, the labels and register macros of pCtx are only read. label references that are
+    // not known yet end up in the fixups of pCtx. on failure pOutError is the earliest failing line
+    bool parseLines(Cpu::SparkAssemblerContext* pCtx, Source::SparkSourceManager* pSources, span<const Source::SparkSourceLine> pLines, IR::SparkProgramIR* pOutIR, SparkThreadPool* pPool, SparkDiagnostic* pOutError)
+    {
+        size_t chunkCount = (pLines.size() + SPARK_PARSE_CHUNK_LINES - 1) / SPARK_PARSE_CHUNK_LINES;
+        vector<SparkParseChunk> chunks(chunkCount);
 
-        size_t position = 26;
-        SafeList<Reg> operandValues;
+        pOutIR->resize(pLines.size());
+        atomic<size_t> firstFailedChunk = chunkCount;
 
-        for (size_t i = 0; i < instructionType->operandCount; i++)
+        auto parseChunkAt = [&](size_t pChunkIdx)
         {
-            size_t operandLength = instructionType->operandLengths[i];
-            Cpu::ESparkOperandType operandType = instructionType->operandTypes[i];
+            // an earlier chunk already failed and is the one reported
+            if (pChunkIdx > firstFailedChunk.load(memory_order_relaxed))
+            {
+                return;
+            }
 
-            position -= operandLength;
+            size_t firstLine = pChunkIdx * SPARK_PARSE_CHUNK_LINES;
+            size_t lineCount = min(SPARK_PARSE_CHUNK_LINES, pLines.size() - firstLine);
 
-            Reg mask = (2 << operandLength - 1) - 1;
-            Reg operandValue = (pAssembled & mask << position) >> position;
-            operandValues.add(operandValue);
+            parseChunk(pCtx, pSources, pLines.subspan(firstLine, lineCount), firstLine, pOutIR, &chunks[pChunkIdx]);
 
-            string operandPrefix = i > 0 ? ", " : " ";
-            string operandStr = operandPrefix + Analysis::operandValueToString(operandValue, operandType, operandLength);
+            if (chunks[pChunkIdx].failed)
+            {
+                size_t current = firstFailedChunk.load(memory_order_relaxed);
+                while (pChunkIdx < current && !firstFailedChunk.compare_exchange_weak(current, pChunkIdx, memory_order_relaxed))
+                {
+                }
+            }
+        };
 
-            line += operandStr;
+        if (pPool)
+        {
+            pPool->parallelFor(chunkCount, parseChunkAt);
+        }
+        else
+        {
+            for (size_t i = 0; i < chunkCount; i++)
+            {
+                parseChunkAt(i);
+            }
         }
 
-        pCtx->success();
-        return line;
-    }
+        for (SparkParseChunk& chunk : chunks)
+        {
+            if (chunk.failed)
+            {
+                *pOutError = std::move(chunk.error);
+                pCtx->error(pOutError->reason);
+                return false;
+            }
 
-#define OPTYPE(operandType, bitLength) Cpu::##operandType, (size_t)##bitLength
+            for (const Cpu::SparkAssemblerFixup& fixup : chunk.fixups)
+            {
+                pCtx->fixups.add(fixup);
+            }
+        }
 
-    void initAssembler()
-    {
-        Cpu::SparkInstructionType::create("liw", Cpu::LIW, 3, OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16), OPTYPE(IMMEDIATE, 1));
-        Cpu::SparkInstructionType::create("addi", Cpu::ADDI, 3, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16));
-        Cpu::SparkInstructionType::create("add", Cpu::ADD, 3, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5));
-        Cpu::SparkInstructionType::create("mov", Cpu::MOV, 2, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5));
-        Cpu::SparkInstructionType::create("cmpr", Cpu::CMPR, 2, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5));
-        Cpu::SparkInstructionType::create("cmpi", Cpu::CMPI, 2, OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16));
-        Cpu::SparkInstructionType::create("jmpcr", Cpu::JMPCR, 2, OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16));
-        Cpu::SparkInstructionType::create("jmp", Cpu::JMP, 1, OPTYPE(REGISTER, 5));
-
-        Cpu::SparkInstructionMacroType::create("inc", Cpu::INC, Cpu::ADDI, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), OP(0), 1));
-
-        Cpu::SparkInstructionMacroType::create("liwl", Cpu::LIWL, Cpu::LIW, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), OP(1), 0));
-        Cpu::SparkInstructionMacroType::create("liwh", Cpu::LIWH, Cpu::LIW, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), OP(1), 1));
-
-        Cpu::SparkInstructionMacroType::create("jmpeq", Cpu::JMPEQ, Cpu::JMPCR, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::EQUAL));
-        Cpu::SparkInstructionMacroType::create("jmpl", Cpu::JMPL, Cpu::JMPCR, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::LESS));
-        Cpu::SparkInstructionMacroType::create("jmpleq", Cpu::JMPLEQ, Cpu::JMPCR, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::LESS_OR_EQUAL));
-        Cpu::SparkInstructionMacroType::create("jmpg", Cpu::JMPG, Cpu::JMPCR, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::GREATER));
-        Cpu::SparkInstructionMacroType::create("jmpgeq", Cpu::JMPGEQ, Cpu::JMPCR, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::GREATER_OR_EQUAL));
-
-        Cpu::SparkInstructionMacroType::create("labreg", Cpu::LABREG, Cpu::ADDI, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::PC, x->findLabel(RAWOP(1))->offset - static_cast<Reg>(*x->currentLine->cpuLineNumberPtr - 1) * 4));
-        Cpu::SparkInstructionMacroType::create("labjmp", Cpu::LABJMP, Cpu::ADDI, SPARK_INSTRUCTION_MACRO_EXPAND(Cpu::JR, Cpu::PC, x->findLabel(RAWOP(0))->offset - static_cast<Reg>(*x->currentLine->cpuLineNumberPtr - 1) * 4));
-
-        Cpu::SparkInstructionMacroType::create("ret", Cpu::RET, Cpu::JMP, SPARK_INSTRUCTION_MACRO_EXPAND(Cpu::RETADDR));
+        pCtx->success();
+        return true;
     }
 }
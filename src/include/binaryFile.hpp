@@ -0,0 +1,103 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "types.hpp"
+
+namespace SPARK
+{
+    // plain values are stored in host byte order, the files never leave the machine family that wrote them
+    template <typename T>
+    bool readValue(FILE* pFile, T* pOutValue)
+    {
+        return fread(pOutValue, sizeof(T), 1, pFile) == 1;
+    }
+
+    template <typename T>
+    bool writeValue(FILE* pFile, const T& pValue)
+    {
+        return fwrite(&pValue, sizeof(T), 1, pFile) == 1;
+    }
+
+    // 0 if the size can not be determined. counts and lengths read from a file are checked against it before anything is
+    // allocated for them, a damaged file fails to read instead of asking for gigabytes
+    uint64_t fileByteCount(FILE* pFile)
+    {
+#ifdef _WIN32
+        struct _stat64 status;
+        return _fstat64(_fileno(pFile), &status) == 0 ? static_cast<uint64_t>(status.st_size) : 0;
+#else
+        struct stat status;
+        return fstat(fileno(pFile), &status) == 0 ? static_cast<uint64_t>(status.st_size) : 0;
+#endif
+    }
+
+    // 32 bit length followed by the bytes, a length past pMaxLength fails
+    bool readString(FILE* pFile, string* pOutString, uint64_t pMaxLength = UINT32_MAX)
+    {
+        uint32_t length = 0;
+        if (!readValue(pFile, &length) || length > pMaxLength)
+        {
+            return false;
+        }
+
+        pOutString->resize(length);
+        return fread(pOutString->data(), 1, length, pFile) == length;
+    }
+
+    bool writeString(FILE* pFile, string_view pString)
+    {
+        return writeValue(pFile, static_cast<uint32_t>(pString.size())) && fwrite(pString.data(), 1, pString.size(), pFile) == pString.size();
+    }
+
+    // the same layout kept in memory, for messages that go over a socket instead of into a file
+    template <typename T>
+    void appendValue(string* pBuffer, const T& pValue)
+    {
+        pBuffer->append(reinterpret_cast<const char*>(&pValue), sizeof(T));
+    }
+
+    void appendString(string* pBuffer, string_view pString)
+    {
+        appendValue(pBuffer, static_cast<uint32_t>(pString.size()));
+        pBuffer->append(pString);
+    }
+
+    // reads what append* wrote, a read past the end fails and leaves the output untouched
+    typedef struct SparkByteReader
+    {
+        string_view data;
+        size_t offset = 0;
+
+        template <typename T>
+        bool readValue(T* pOutValue)
+        {
+            if (data.size() - offset < sizeof(T))
+            {
+                return false;
+            }
+
+            memcpy(pOutValue, data.data() + offset, sizeof(T));
+            offset += sizeof(T);
+            return true;
+        }
+
+        bool readString(string* pOutString)
+        {
+            uint32_t length = 0;
+            if (!readValue(&length) || data.size() - offset < length)
+            {
+                return false;
+            }
+
+            pOutString->assign(data.substr(offset, length));
+            offset += length;
+            return true;
+        }
+    } SparkByteReader;
+}
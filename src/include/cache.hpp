@@ -0,0 +1,173 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "binaryFile.hpp"
+#include "hash.hpp"
+#include "isa.hpp"
+#include "output.hpp"
+#include "source.hpp"
+#include "symbols.hpp"
+
+namespace SPARK::Assembler::Cache
+{
+    constexpr uint32_t SPARK_CACHE_MAGIC = 0x434B5053; // "SPKC"
+    // 2: words are stored in host byte order
+    constexpr uint32_t SPARK_CACHE_FORMAT_VERSION = 2;
+
+    // what one assembled translation unit leaves behind, words are in host byte order so one entry serves every output endianness
+    typedef struct SparkCachedAssembly
+    {
+        vector<Reg> words;
+        vector<Cpu::SparkAssemblerLabel> labels;
+    } SparkCachedAssembly;
+
+    // the expanded text of the program and the isa it was encoded for, file names and include paths do not matter
+    uint64_t computeProgramKey(Source::SparkSourceManager* pSources, const Source::SparkSegmentList& pProgram)
+    {
+        SparkHasher hasher(Cpu::gIsaVersion);
+
+        for (const Source::SparkSourceSegment& segment : pProgram.segments)
+        {
+            span<const Source::SparkSourceLine> lines = pSources->segmentLines(segment);
+
+            // the lines of a segment are contiguous in their file and go in with one call
+            size_t begin = lines.front().offset;
+            size_t end = lines.back().offset + lines.back().length;
+
+            hasher.update(pSources->contents(segment.fileId).substr(begin, end - begin));
+            hasher.update("\n");
+        }
+
+        return hasher.digest();
+    }
+
+    string cacheEntryPath(const string& pCacheDirectory, uint64_t pKey)
+    {
+        return (std::filesystem::path(pCacheDirectory) / format("{0:016X}.sparkcache", pKey)).string();
+    }
+
+    // a missing, damaged or foreign entry is a miss
+    bool loadCachedAssembly(const string& pCacheDirectory, uint64_t pKey, SparkCachedAssembly* pOutAssembly)
+    {
+        FILE* fp = fopen(cacheEntryPath(pCacheDirectory, pKey).c_str(), "rb");
+        if (!fp)
+        {
+            return false;
+        }
+
+        uint32_t magic = 0;
+        uint32_t formatVersion = 0;
+        uint64_t key = 0;
+        uint32_t wordCount = 0;
+        uint32_t labelCount = 0;
+
+        bool valid = readValue(fp, &magic) && readValue(fp, &formatVersion) && readValue(fp, &key) && readValue(fp, &wordCount) && readValue(fp, &labelCount);
+        valid = valid && magic == SPARK_CACHE_MAGIC && formatVersion == SPARK_CACHE_FORMAT_VERSION && key == pKey;
+
+        // a truncated entry has fewer bytes left than its counts promise, every label takes at least its offset and length
+        uint64_t entryBytes = fileByteCount(fp);
+        uint64_t headerBytes = sizeof(magic) + sizeof(formatVersion) + sizeof(key) + sizeof(wordCount) + sizeof(labelCount);
+        uint64_t promisedBytes = uint64_t(wordCount) * sizeof(Reg) + uint64_t(labelCount) * (sizeof(Reg) + sizeof(uint32_t));
+        valid = valid && entryBytes >= headerBytes && promisedBytes <= entryBytes - headerBytes;
+
+        if (valid)
+        {
+            pOutAssembly->words.resize(wordCount);
+            valid = fread(pOutAssembly->words.data(), sizeof(Reg), wordCount, fp) == wordCount;
+        }
+
+        pOutAssembly->labels.clear();
+        for (uint32_t i = 0; valid && i < labelCount; i++)
+        {
+            Reg offset = 0;
+            string name;
+
+            valid = readValue(fp, &offset) && readString(fp, &name, entryBytes);
+            pOutAssembly->labels.emplace_back(offset, name);
+        }
+
+        fclose(fp);
+        return valid;
+    }
+
+    // written under a temporary name and renamed, a concurrent build never reads a half written entry
+    bool storeCachedAssembly(const string& pCacheDirectory, uint64_t pKey, const SparkCachedAssembly& pAssembly)
+    {
+        error_code error;
+        std::filesystem::create_directories(pCacheDirectory, error);
+
+        SparkOutputFile entry(cacheEntryPath(pCacheDirectory, pKey));
+
+        FILE* fp = fopen(entry.writePath().c_str(), "wb");
+        if (!fp)
+        {
+            return false;
+        }
+
+        bool written = writeValue(fp, SPARK_CACHE_MAGIC) && writeValue(fp, SPARK_CACHE_FORMAT_VERSION) && writeValue(fp, pKey);
+        written = written && writeValue(fp, static_cast<uint32_t>(pAssembly.words.size())) && writeValue(fp, static_cast<uint32_t>(pAssembly.labels.size()));
+        written = written && fwrite(pAssembly.words.data(), sizeof(Reg), pAssembly.words.size(), fp) == pAssembly.words.size();
+
+        for (const Cpu::SparkAssemblerLabel& label : pAssembly.labels)
+        {
+            written = written && writeValue(fp, label.offset) && writeString(fp, label.name);
+        }
+
+        written = entry.close(fp) && written;
+
+        return written && entry.commit();
+    }
+
+    // entries a long running process keeps around, the oldest one goes first once it is full
+    constexpr size_t SPARK_MEMORY_CACHE_MAX_ENTRIES = 1024;
+
+    // the in memory counterpart of the cache directory, safe to share between threads
+    typedef class SparkMemoryCache
+    {
+        mutex lock;
+        map<uint64_t, SparkCachedAssembly> entries;
+        deque<uint64_t> insertionOrder;
+
+    public:
+        bool find(uint64_t pKey, SparkCachedAssembly* pOutAssembly)
+        {
+            lock_guard guard(lock);
+
+            auto cached = entries.find(pKey);
+            if (cached == entries.end())
+            {
+                return false;
+            }
+
+            *pOutAssembly = cached->second;
+            return true;
+        }
+
+        void store(uint64_t pKey, const SparkCachedAssembly& pAssembly)
+        {
+            lock_guard guard(lock);
+
+            if (!entries.insert_or_assign(pKey, pAssembly).second)
+            {
+                return;
+            }
+
+            insertionOrder.push_back(pKey);
+
+            if (insertionOrder.size() > SPARK_MEMORY_CACHE_MAX_ENTRIES)
+            {
+                entries.erase(insertionOrder.front());
+                insertionOrder.pop_front();
+            }
+        }
+    } SparkMemoryCache;
+}
@@ -1,11 +1,18 @@
 ﻿#pragma once
 
 #include "types.hpp"
+#include <algorithm>
 #include <map>
+#include <span>
 #include <utility>
-#include <stdarg.h>
+#include <vector>
 
+#include "arena.hpp"
+#include "lexer.hpp"
+#include "perfectHash.hpp"
 #include "SafeList.hpp"
+#include "stats.hpp"
+#include "symbols.hpp"
 #include "log.hpp"
 
 namespace SPARK::Cpu
@@ -68,7 +75,7 @@ namespace SPARK::Cpu
         HIRV,
     };
 
-    inline SafeList<string> gRegisterNameTable({
+    inline constexpr array<string_view, 32> gRegisterNameTable = {
         "a0",
         "a1",
         "a2",
@@ -101,20 +108,13 @@ namespace SPARK::Cpu
         "cr",
         "rtclo",
         "rtchi"
-    });
+    };
+
+    inline constexpr SparkPerfectHashTable gRegisterLookup(enumerateHashEntries<ESparkExternalRegister>(gRegisterNameTable), INVREG);
 
-    ESparkExternalRegister stringRegisterToRegisterValue(const string& pRegisterStr)
+    ESparkExternalRegister stringRegisterToRegisterValue(string_view pRegisterStr)
     {
-        size_t registerCount = gRegisterNameTable.count();
-        for (size_t i = 0; i < registerCount; i++)
-        {
-            if (gRegisterNameTable[i] == pRegisterStr)
-            {
-                return static_cast<ESparkExternalRegister>(i);
-            }
-        }
-        
-        return INVREG;
+        return gRegisterLookup.find(pRegisterStr);
     }
 
     enum ESparkConditionRegisterValues
@@ -173,95 +173,102 @@ namespace SPARK::Cpu
         RET,
     };
 
-    class SparkInstructionType;
-    class SparkInstructionMacroType;
+    constexpr size_t SPARK_MAX_OPERANDS = 3;
 
-    inline map<string, ESparkInstructionOpcodeId> gOpcodeSet;
-    inline map<ESparkInstructionOpcodeId, SparkInstructionType*> gInstructionSet;
-    inline map<string, ESparkInstructionMacroOpcodeId> gMacroSet;
-    inline map<ESparkInstructionMacroOpcodeId, SparkInstructionMacroType*> gMacroInstructionSet;
-    inline map<ESparkInstructionOpcodeId, SafeList<SparkInstructionMacroType*>> gMacrosByInstructionOpcodes;
+    // operands of one instruction, never more than fit inline
+    typedef SafeList<Reg, SPARK_MAX_OPERANDS> SparkOperandList;
 
-    typedef class SparkInstructionType
+    typedef struct SparkOperandField
     {
-    public:
-        string opcodeStr;
-        ESparkInstructionOpcodeId opcodeId;
-        size_t operandCount;
-        SafeList<ESparkOperandType> operandTypes;
-        SafeList<size_t> operandLengths;
+        ESparkOperandType type;
+        size_t length;
+    } SparkOperandField;
+
+    // one instantiation per instruction, the field layout is checked and its shifts computed at compile time. the encode and
+    // decode tables are built from the resulting instruction types
+    template <ESparkInstructionOpcodeId OpcodeId, SparkOperandField... Fields>
+    struct SparkInstructionEncoding
+    {
+        static constexpr ESparkInstructionOpcodeId OPCODE_ID = OpcodeId;
+        static constexpr size_t OPERAND_COUNT = sizeof...(Fields);
+        static constexpr size_t BIT_LENGTH = (6 + ... + Fields.length);
 
-        static void create(string pOpcodeStr, ESparkInstructionOpcodeId pOpcodeId, size_t pOperandCount, ...)
-        {
-            auto* instance = new SparkInstructionType();
+        static_assert(OpcodeId > 0 && OpcodeId < 64, "Opcodes are 6 bits wide.");
+        static_assert(OPERAND_COUNT <= SPARK_MAX_OPERANDS, "Too many operands, raise SPARK_MAX_OPERANDS.");
+        static_assert(((Fields.length > 0 && Fields.length < 32) && ...), "Operand fields must be 1 to 31 bits wide.");
+        static_assert(BIT_LENGTH <= 32, "Instruction exceeded the maximum bit length (32).");
 
-            instance->opcodeStr = std::move(pOpcodeStr);
-            instance->opcodeId = pOpcodeId;
-            instance->operandCount = pOperandCount;
+        static constexpr array<SparkOperandField, OPERAND_COUNT> FIELDS = {Fields...};
 
-            instance->operandTypes = SafeList<ESparkOperandType>();
-            instance->operandLengths = SafeList<size_t>();
+        static constexpr array<Reg, OPERAND_COUNT> computeShifts()
+        {
+            array<Reg, OPERAND_COUNT> shifts{};
+            Reg position = 26;
 
-            va_list args;
-            va_start(args, pOperandCount);
+            for (size_t i = 0; i < OPERAND_COUNT; i++)
+            {
+                position -= static_cast<Reg>(FIELDS[i].length);
+                shifts[i] = position;
+            }
 
-            size_t totalBitLength = 6;
+            return shifts;
+        }
 
-            for (size_t i = 0; i < instance->operandCount; i++)
-            {
-                ESparkOperandType operandType = va_arg(args, ESparkOperandType);
-                size_t bitLength = va_arg(args, size_t);
+        static constexpr array<Reg, OPERAND_COUNT> SHIFTS = computeShifts();
+    };
 
-                totalBitLength += bitLength;
+    typedef class SparkInstructionType
+    {
+    public:
+        string_view opcodeStr;
+        ESparkInstructionOpcodeId opcodeId = INVOP;
+        size_t operandCount = 0;
+        array<ESparkOperandType, SPARK_MAX_OPERANDS> operandTypes{};
+        array<size_t, SPARK_MAX_OPERANDS> operandLengths{};
+        array<Reg, SPARK_MAX_OPERANDS> operandShifts{};
 
-                instance->operandTypes.add(operandType);
-                instance->operandLengths.add(bitLength);
-            }
+        template <class Encoding>
+        static constexpr SparkInstructionType describe(string_view pOpcodeStr)
+        {
+            SparkInstructionType type;
+
+            type.opcodeStr = pOpcodeStr;
+            type.opcodeId = Encoding::OPCODE_ID;
+            type.operandCount = Encoding::OPERAND_COUNT;
 
-            if (totalBitLength > 32)
+            for (size_t i = 0; i < Encoding::OPERAND_COUNT; i++)
             {
-                LOGERR("Instruction '{0}' exceeded the maximum bit length (32) by {1} bits (total {2}).\n", pOpcodeStr, totalBitLength - 32, totalBitLength);
+                type.operandTypes[i] = Encoding::FIELDS[i].type;
+                type.operandLengths[i] = Encoding::FIELDS[i].length;
+                type.operandShifts[i] = Encoding::SHIFTS[i];
             }
 
-            va_end(args);
-
-            gInstructionSet[instance->opcodeId] = instance;
-            gOpcodeSet[instance->opcodeStr] = instance->opcodeId;
+            return type;
         }
-
-        ~SparkInstructionType() = default;
     } SparkInstructionType;
 
+    // the operand arrays are not owned, they live in the arena of the context that parsed the line
     typedef class SparkInstructionInstance
     {
-        SafeList<Reg> operandValues;
+        span<Reg> operandValues;
 
     public:
-        SparkInstructionType* base;
-        SafeList<string> rawOperandValues;
+        const SparkInstructionType* base = nullptr;
+        span<string_view> rawOperandValues;
 
-        SparkInstructionInstance()
-        {
-            base = gInstructionSet[INVOP];
-            operandValues = SafeList<Reg>();
-            rawOperandValues = SafeList<string>();
-        }
+        SparkInstructionInstance() = default;
 
-        SparkInstructionInstance(ESparkInstructionOpcodeId pOpcodeId, SafeList<Reg> pOperandValues, const SafeList<string>& pRawOperandValues)
+        // operand values are masked to their field width by the encode tables
+        SparkInstructionInstance(const SparkInstructionType* pBase, span<Reg> pOperandValues, span<string_view> pRawOperandValues)
         {
-            base = gInstructionSet[pOpcodeId];
+            base = pBase;
+            operandValues = pOperandValues;
             rawOperandValues = pRawOperandValues;
-
-            for (size_t idx = 0; idx < pOperandValues.count(); idx++)
-            {
-                Reg operandValue = pOperandValues[idx];
-                operandValues.add(operandValue & (1 << base->operandLengths[idx]) - 1);
-            }
         }
 
-        SafeList<Reg>* getOperandValues()
+        span<Reg> getOperandValues()
         {
-            return &operandValues;
+            return operandValues;
         }
 
         Reg getOperandValue(size_t pIdx)
@@ -273,47 +280,28 @@ namespace SPARK::Cpu
 
 #define SPARK_INSTRUCTION_MACRO_EXPAND(...) [](Cpu::SparkAssemblerContext* x) \
     { \
-        return SafeList<Reg>({__VA_ARGS__}); \
+        return Cpu::SparkOperandList({__VA_ARGS__}); \
     }
 
 #define OP(idx) x->currentInstruction->getOperandValue(idx)
 #define RAWOP(idx) x->currentInstruction->rawOperandValues[idx]
 
-    typedef struct SparkAssemblerLabel
-    {
-        Reg offset;
-        string name;
-
-        SparkAssemblerLabel(Reg pOffset, const string& pName)
-        {
-            offset = pOffset;
-            name = pName;
-        }
-    } SparkAssemblerLabel;
-
+    // the line a context is working on, owned by the context so it never points into the caller's stack
     typedef struct AssemblyLine
     {
-        size_t* cpuLineNumberPtr; // 1 onwards
-        size_t* assemblerLineNumberPtr; // 1 onwards
-        string* rawLineContentsPtr;
-        string* cleanLineContentsPtr;
-
-        AssemblyLine(size_t* pLineNumberPtr, size_t* pAssemblerLineNumberPtr, string* pRawLineContentsPtr, string* pCleanLineContentsPtr)
-        {
-            cpuLineNumberPtr = pLineNumberPtr;
-            rawLineContentsPtr = pRawLineContentsPtr;
-            cleanLineContentsPtr = pCleanLineContentsPtr;
-            assemblerLineNumberPtr = pAssemblerLineNumberPtr;
-        }
+        size_t cpuLineNumber = 0; // 1 onwards
+        size_t assemblerLineNumber = 0; // 1 onwards
+        string_view rawLineContents;
+        Assembler::Lexer::SparkLineTokens tokens;
 
         void incrementCpuLineCounter()
         {
-            *cpuLineNumberPtr = *cpuLineNumberPtr + 1;
+            cpuLineNumber++;
         }
 
         void incrementAssemblerLineCounter()
         {
-            *assemblerLineNumberPtr = *assemblerLineNumberPtr + 1;
+            assemblerLineNumber++;
         }
     } AssemblyLine;
 
@@ -330,7 +318,7 @@ namespace SPARK::Cpu
 
     typedef struct SparkAssemblerErrorContext
     {
-        ESparkAssemblerResult result;
+        ESparkAssemblerResult result = NONE;
         string reason;
 
         void success()
@@ -351,37 +339,61 @@ namespace SPARK::Cpu
         }
     } SparkAssemblerErrorContext;
 
+    // a register macro stays in effect from its line until it is redefined, cpuLineNumber counts the instructions before it
+    typedef struct SparkRegisterMacroDefinition
+    {
+        size_t cpuLineNumber;
+        ESparkExternalRegister value;
+    } SparkRegisterMacroDefinition;
+
     typedef struct SparkAssemblerContext
     {
-        SafeList<SparkAssemblerLabel*> labels;
+        // owns the labels and the instruction of the current line, declared first so it outlives everything pointing into it
+        SparkArena arena;
+
+        SparkSymbolTable labels;
+        SafeList<SparkAssemblerFixup> fixups;
         SafeList<string> absoluteIncludePaths;
-        SparkInstructionInstance* currentInstruction;
-        SparkAssemblerErrorContext* errorContext;
-        AssemblyLine* currentLine;
+        // allocated in arena, only valid while its line is being encoded
+        SparkInstructionInstance* currentInstruction = nullptr;
+        SparkAssemblerErrorContext errorContext;
+        AssemblyLine currentLine;
         std::filesystem::path currentFile;
 
-        map<string, ESparkExternalRegister> registerMacros;
+        // relative include paths are resolved against this instead of the process directory, empty means the process directory
+        std::filesystem::path workingDirectory;
 
-        SparkAssemblerContext(const string& pCurrentFilePath, SparkInstructionInstance* pCurrentInstruction, SparkAssemblerErrorContext* pErrCtx, size_t* pLineNumberPtr, size_t* pAssemblerLineNumberPtr, string* pCurrentLineRaw, string* pCurrentLineClean)
-        {
-            setCurrentFile(pCurrentFilePath);
+        map<string, vector<SparkRegisterMacroDefinition>, less<>> registerMacros;
 
-            labels = SafeList<SparkAssemblerLabel*>();
+        // null unless the run collects stats or records a trace, the clock times the phases this context goes through
+        Stats::SparkStats* stats = nullptr;
+        Trace::SparkTraceRecorder* trace = nullptr;
+        Stats::SparkPhaseClock phases;
 
-            currentInstruction = pCurrentInstruction;
-            errorContext = pErrCtx;
-            currentLine = new AssemblyLine(pLineNumberPtr, pAssemblerLineNumberPtr, pCurrentLineRaw, pCurrentLineClean);
+        // labels and register macros are looked up here, worker contexts share the ones of the main context
+        SparkAssemblerContext* symbolContext = this;
+
+        // one per job, contexts share nothing but the constexpr isa tables
+        explicit SparkAssemblerContext(const string& pCurrentFilePath = "")
+        {
+            setCurrentFile(pCurrentFilePath);
         }
 
-        explicit SparkAssemblerContext(SparkAssemblerErrorContext* pErrCtx) : SparkAssemblerContext("", nullptr, pErrCtx, nullptr, nullptr, nullptr, nullptr)
+        // worker context, has its own error and line state but only reads the symbols of pSymbolContext
+        explicit SparkAssemblerContext(SparkAssemblerContext* pSymbolContext) : SparkAssemblerContext(pSymbolContext->currentFile.string())
         {
+            symbolContext = pSymbolContext;
+            attachInstrumentation(pSymbolContext->stats, pSymbolContext->trace);
         }
 
-        ~SparkAssemblerContext()
+        SparkAssemblerContext(const SparkAssemblerContext&) = delete;
+        SparkAssemblerContext& operator=(const SparkAssemblerContext&) = delete;
+
+        void attachInstrumentation(Stats::SparkStats* pStats, Trace::SparkTraceRecorder* pTrace)
         {
-            delete currentLine;
-            delete errorContext;
-            delete currentInstruction;
+            stats = pStats;
+            trace = pTrace;
+            phases.attach(pStats, pTrace);
         }
 
         void setCurrentFile(const string& pPath)
@@ -393,7 +405,7 @@ namespace SPARK::Cpu
         {
             try
             {
-                string expanded = std::filesystem::canonical(pPath).generic_string();
+                string expanded = std::filesystem::canonical(workingDirectory / pPath).generic_string();
                 absoluteIncludePaths.add(expanded);
 
                 success();
@@ -404,196 +416,156 @@ namespace SPARK::Cpu
             }
         }
 
-        string expandIncludeStatementPath(SparkAssemblerContext* pCtx, const string& pPath)
+        void setRegisterMacro(string_view pRepr, ESparkExternalRegister pRegister)
         {
-            string conflicts;
-            string finalPath;
-            std::filesystem::path includeStatementPathObject(pPath);
-
-            size_t foundMatches = 0;
-
-            for (const auto& includePath : absoluteIncludePaths)
+            if (pRegister == INVREG)
             {
-                std::filesystem::path target = includeStatementPathObject.concat(includePath);
-                if (exists(target))
-                {
-                    foundMatches++;
-
-                    if (foundMatches > 1)
-                    {
-                        conflicts += (conflicts.empty() ? "" : ", ") + target.string();
-                        continue;
-                    }
-
-                    finalPath = target.string();
-                }
+                error(format("Invalid register found in register macro '{0}'.\n", pRepr));
+                return;
             }
 
-            if (foundMatches == 0)
-            {
-                pCtx->error(format("Could not resolve include path '{0}' in file '{1}'.\n", includeStatementPathObject.string(), pCtx->currentFile.string()));
-                return "";
-            }
+            // definitions arrive in program order, a redefinition with no instruction in between replaces the previous one
+            vector<SparkRegisterMacroDefinition>& definitions = registerMacros[string(pRepr)];
+            size_t lineNumber = currentLine.cpuLineNumber;
 
-            if (foundMatches > 1)
+            if (!definitions.empty() && definitions.back().cpuLineNumber == lineNumber)
             {
-                pCtx->error(format("Found conflicts in include path '{0}'.\n", conflicts));
-                return "";
+                definitions.back().value = pRegister;
+                return;
             }
 
-            return finalPath;
+            definitions.push_back({lineNumber, pRegister});
         }
 
-        void setRegisterMacro(const string& pRepr, ESparkExternalRegister pRegister)
+        // the definition in effect for the current instruction, macros defined further down are not visible yet
+        const SparkRegisterMacroDefinition* findRegisterMacro(string_view pRepr)
         {
-            if (pRegister == INVREG)
+            auto it = symbolContext->registerMacros.find(pRepr);
+            if (it == symbolContext->registerMacros.end())
             {
-                error(format("Invalid register found in register macro '{0}'.\n", pRepr));
-                return;
+                return nullptr;
             }
-            registerMacros[pRepr] = pRegister;
+
+            const vector<SparkRegisterMacroDefinition>& definitions = it->second;
+            size_t instructionsBefore = currentLine.cpuLineNumber - 1;
+
+            auto next = upper_bound(definitions.begin(), definitions.end(), instructionsBefore, [](size_t pLine, const SparkRegisterMacroDefinition& pDefinition) { return pLine < pDefinition.cpuLineNumber; });
+            return next == definitions.begin() ? nullptr : &*prev(next);
         }
 
-        ESparkExternalRegister getRegisterFromRegisterMacroRepresentation(const string& pRegisterStr)
+        ESparkExternalRegister getRegisterFromRegisterMacroRepresentation(string_view pRegisterStr)
         {
-            return registerMacros[pRegisterStr];
+            const SparkRegisterMacroDefinition* definition = findRegisterMacro(pRegisterStr);
+            return definition ? definition->value : INVREG;
         }
 
-        bool registerMacroExists(const string& pRepr)
+        bool registerMacroExists(string_view pRepr)
         {
-            return registerMacros.contains(pRepr);
+            return findRegisterMacro(pRepr) != nullptr;
         }
 
         void incrementCpuLineNumber()
         {
-            currentLine->incrementCpuLineCounter();
+            currentLine.incrementCpuLineCounter();
         }
 
         void incrementAssemblerLineNumber()
         {
-            currentLine->incrementAssemblerLineCounter();
+            currentLine.incrementAssemblerLineCounter();
         }
 
         void success()
         {
-            errorContext->success();
+            errorContext.success();
         }
 
         void error(const string& pReason)
         {
-            errorContext->error(pReason);
+            errorContext.error(pReason);
         }
 
         void ignore(const string& pReason)
         {
-            errorContext->ignore(pReason);
+            errorContext.ignore(pReason);
         }
 
         bool isSuccessful()
         {
-            return errorContext->result == SUCCESS;
+            return errorContext.result == SUCCESS;
         }
 
         bool isError()
         {
-            return errorContext->result == ERROR;
+            return errorContext.result == ERROR;
         }
 
         bool isIgnore()
         {
-            return errorContext->result == IGNORE;
+            return errorContext.result == IGNORE;
         }
 
         string getReason()
         {
-            return errorContext->reason;
+            return errorContext.reason;
         }
 
-        SparkAssemblerLabel* findLabel(const string& pLabelName)
+        SparkAssemblerLabel* findLabel(string_view pLabelName)
         {
-            return labels.find<string>([](SparkAssemblerLabel* pLabel) { return pLabel->name; }, pLabelName);
+            return symbolContext->labels.find(pLabelName);
         }
-    } SparkAssemblerContext;
 
-    typedef SafeList<Reg> (*SparkInstructionMacroExpander)(SparkAssemblerContext*);
-
-    typedef class SparkInstructionMacroType
-    {
-    public:
-        string opcode;
-        ESparkInstructionMacroOpcodeId opcodeId;
-        ESparkInstructionOpcodeId baseOpcodeId;
-        SparkInstructionMacroExpander parserFunction;
-
-        static void create(const string& pOpcode, ESparkInstructionMacroOpcodeId pMacroOpcodeId, ESparkInstructionOpcodeId pBaseOpcodeId, SparkInstructionMacroExpander pParserFunction)
+        bool addLabel(Reg pOffset, string_view pLabelName)
         {
-            auto* instance = new SparkInstructionMacroType();
-
-            instance->opcode = pOpcode;
-            instance->opcodeId = pMacroOpcodeId;
-            instance->baseOpcodeId = pBaseOpcodeId;
-            instance->parserFunction = pParserFunction;
+            // a rejected label stays in the arena until the context goes away, it is an error that ends the assembly anyway
+            auto* label = arena.create<SparkAssemblerLabel>(pOffset, string(pLabelName));
+            if (!labels.add(label))
+            {
+                error(format("Label '{0}' is already defined.\n", pLabelName));
+                return false;
+            }
 
-            gMacroSet[instance->opcode] = instance->opcodeId;
-            gMacroInstructionSet[instance->opcodeId] = instance;
-            gMacrosByInstructionOpcodes[instance->baseOpcodeId].add(instance);
+            return true;
         }
-    } SparkInstructionMacroType;
 
-    ESparkInstructionOpcodeId getOpcodeIdFromOpcodeStr(const string& pOpcodeStr)
-    {
-        if (!gOpcodeSet.contains(pOpcodeStr))
+        // pc relative offset from the current instruction to the label, stored in operand pOperandIdx of the current instruction
+        Reg labelOffsetFromCurrentInstruction(string_view pLabelName, size_t pOperandIdx)
         {
-            return INVOP;
-        }
-
-        return gOpcodeSet[pOpcodeStr];
-    }
-
-    ESparkInstructionMacroOpcodeId getMacroOpcodeIdFromOpcodeStr(const string& pOpcodeStr)
-    {
-        if (!gMacroSet.contains(pOpcodeStr))
-        {
-            return INVMACRO;
-        }
+            Reg instructionOffset = static_cast<Reg>(currentLine.cpuLineNumber - 1) * 4;
 
-        return gMacroSet[pOpcodeStr];
-    }
+            SparkAssemblerLabel* label = findLabel(pLabelName);
+            if (label)
+            {
+                return label->offset - instructionOffset;
+            }
 
-    SparkInstructionMacroType* getMacroTypeFromId(ESparkInstructionMacroOpcodeId pOpcodeId)
-    {
-        if (!gMacroInstructionSet.contains(pOpcodeId))
-        {
-            return nullptr;
-        }
+            Reg fieldShift = currentInstruction->base->operandShifts[pOperandIdx];
+            size_t fieldLength = currentInstruction->base->operandLengths[pOperandIdx];
 
-        return gMacroInstructionSet[pOpcodeId];
-    }
+            fixups.add({
+                .wordIndex = currentLine.cpuLineNumber - 1,
+                .instructionOffset = instructionOffset,
+                .fieldShift = fieldShift,
+                .fieldMask = fieldLength >= 32 ? ~0u : (1u << fieldLength) - 1,
+                .operandIndex = pOperandIdx,
+                .labelName = string(pLabelName),
+                .file = currentFile.string(),
+                .lineNumber = currentLine.assemblerLineNumber,
+                .lineContents = string(currentLine.rawLineContents),
+            });
 
-    SafeList<SparkInstructionMacroType*> getMacrosFromInstructionOpcodeId(ESparkInstructionOpcodeId pInstructionOpcodeId)
-    {
-        return gMacrosByInstructionOpcodes[pInstructionOpcodeId];
-    }
-
-    SparkInstructionType* getInstructionTypeFromOpcodeId(ESparkInstructionOpcodeId pOpcodeId)
-    {
-        if (!gInstructionSet.contains(pOpcodeId))
-        {
-            return nullptr;
+            return 0;
         }
+    } SparkAssemblerContext;
 
-        return gInstructionSet[pOpcodeId];
-    }
-
+    typedef SparkOperandList (*SparkInstructionMacroExpander)(SparkAssemblerContext*);
 
-    string getOpcodeStrFromOpcodeId(ESparkInstructionOpcodeId pOpcodeId)
+    typedef class SparkInstructionMacroType
     {
-        SparkInstructionType* instructionType = getInstructionTypeFromOpcodeId(pOpcodeId);
-        if (!instructionType)
-        {
-            return "";
-        }
-
-        return instructionType->opcodeStr;
-    }
+    public:
+        string_view opcode;
+        ESparkInstructionMacroOpcodeId opcodeId;
+        ESparkInstructionOpcodeId baseOpcodeId;
+        size_t operandCount;
+        SparkInstructionMacroExpander parserFunction;
+    } SparkInstructionMacroType;
 }
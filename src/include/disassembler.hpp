@@ -0,0 +1,477 @@
+﻿#pragma once
+
+#include <array>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "isa.hpp"
+#include "assembler.hpp"
+#include "emitter.hpp"
+#include "endian.hpp"
+#include "stats.hpp"
+#include "threadPool.hpp"
+#include "log.hpp"
+
+namespace SPARK::Assembler::Disassembly
+{
+    // unused operand slots have a zero mask so every word goes through the same branch-free extraction
+    typedef struct SparkDecodeTableEntry
+    {
+        bool valid;
+        uint8_t operandCount;
+        array<Reg, Cpu::SPARK_MAX_OPERANDS> shifts;
+        array<Reg, Cpu::SPARK_MAX_OPERANDS> masks;
+    } SparkDecodeTableEntry;
+
+    constexpr array<SparkDecodeTableEntry, 64> buildDecodeTable()
+    {
+        array<SparkDecodeTableEntry, 64> table{};
+
+        for (size_t opcode = 0; opcode < table.size(); opcode++)
+        {
+            const Cpu::SparkInstructionType& type = Cpu::gInstructionSet[opcode];
+            SparkDecodeTableEntry& entry = table[opcode];
+
+            entry.valid = type.opcodeId != Cpu::INVOP;
+            entry.operandCount = static_cast<uint8_t>(type.operandCount);
+
+            for (size_t i = 0; i < type.operandCount; i++)
+            {
+                entry.shifts[i] = type.operandShifts[i];
+                entry.masks[i] = (1u << type.operandLengths[i]) - 1;
+            }
+        }
+
+        return table;
+    }
+
+    // indexed by the 6 bit opcode
+    inline constexpr array<SparkDecodeTableEntry, 64> gDecodeTable = buildDecodeTable();
+
+    // struct of arrays, operands[k][i] is operand k of word i
+    typedef struct SparkDecodedBatch
+    {
+        vector<uint8_t> opcodes;
+        array<vector<Reg>, Cpu::SPARK_MAX_OPERANDS> operands;
+
+        // index of the first word with an unknown opcode, equal to count() when every word decoded
+        size_t firstInvalid = 0;
+
+        void resize(size_t pCount)
+        {
+            opcodes.resize(pCount);
+            for (vector<Reg>& column : operands)
+            {
+                column.resize(pCount);
+            }
+        }
+
+        size_t count() const
+        {
+            return opcodes.size();
+        }
+
+        bool valid() const
+        {
+            return firstInvalid == count();
+        }
+    } SparkDecodedBatch;
+
+    // pWords must already be in host byte order
+    void decodeBatch(span<const Reg> pWords, SparkDecodedBatch* pOutBatch)
+    {
+        size_t count = pWords.size();
+        pOutBatch->resize(count);
+
+        uint8_t* opcodes = pOutBatch->opcodes.data();
+        Reg* operands0 = pOutBatch->operands[0].data();
+        Reg* operands1 = pOutBatch->operands[1].data();
+        Reg* operands2 = pOutBatch->operands[2].data();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            Reg word = pWords[i];
+            auto opcode = static_cast<uint8_t>(word >> 26);
+            const SparkDecodeTableEntry& entry = gDecodeTable[opcode];
+
+            opcodes[i] = opcode;
+            operands0[i] = word >> entry.shifts[0] & entry.masks[0];
+            operands1[i] = word >> entry.shifts[1] & entry.masks[1];
+            operands2[i] = word >> entry.shifts[2] & entry.masks[2];
+        }
+
+        // validated after the fact so the extraction loop above stays free of branches
+        pOutBatch->firstInvalid = count;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!gDecodeTable[opcodes[i]].valid)
+            {
+                pOutBatch->firstInvalid = i;
+                break;
+            }
+        }
+    }
+
+    void reportInvalidInstruction(Cpu::SparkAssemblerContext* pCtx, Reg pInstruction)
+    {
+        Reg opcodeId = pInstruction >> 26;
+        pCtx->error(format("No instruction type structure was found under opcode '{0}' (binary '{1:06B}') extracted from assembled instruction '{2:08X}'.", opcodeId, opcodeId, pInstruction));
+    }
+
+    constexpr size_t maxOperandTextLength(Cpu::ESparkOperandType pOperandType, size_t pBitLength)
+    {
+        if (pOperandType == Cpu::REGISTER)
+        {
+            size_t longest = 0;
+            for (string_view registerName : Cpu::gRegisterNameTable)
+            {
+                longest = registerName.size() > longest ? registerName.size() : longest;
+            }
+            return longest;
+        }
+
+        switch (pBitLength)
+        {
+        case 1:
+            return string_view("0x1").size();
+        case 8:
+            return string_view("-0x80").size();
+        case 16:
+            return string_view("-0x8000").size();
+        case 32:
+            return string_view("-0x80000000").size();
+        default:
+            return 0;
+        }
+    }
+
+    constexpr size_t computeMaxLineLength()
+    {
+        size_t longest = 0;
+
+        for (const Cpu::SparkInstructionType& type : Cpu::gInstructionTypes)
+        {
+            size_t length = type.opcodeStr.size();
+            for (size_t i = 0; i < type.operandCount; i++)
+            {
+                length += (i > 0 ? 2 : 1) + maxOperandTextLength(type.operandTypes[i], type.operandLengths[i]);
+            }
+
+            longest = length > longest ? length : longest;
+        }
+
+        return longest;
+    }
+
+    // hexdump columns start here, fixed by the isa so the listing can be streamed without knowing every line up front
+    inline constexpr size_t SPARK_HEXDUMP_COLUMN = computeMaxLineLength();
+
+    void emitImmediate(SparkTextEmitter* pEmitter, Reg pValue, size_t pBitLength)
+    {
+        int64_t signedValue;
+
+        switch (pBitLength)
+        {
+        case 1:
+            {
+                pEmitter->append("0x");
+                pEmitter->appendHex(pValue);
+            }
+            return;
+        case 8:
+            signedValue = static_cast<int8_t>(pValue);
+            break;
+        case 16:
+            signedValue = static_cast<int16_t>(pValue);
+            break;
+        case 32:
+            signedValue = static_cast<int32_t>(pValue);
+            break;
+        default:
+            {
+                LOGWRN("The immediate 0x{0:X} has a bit length of {1}, which is not supported (8, 16, 32).\n", pValue, pBitLength);
+            }
+            return;
+        }
+
+        if (signedValue < 0)
+        {
+            pEmitter->appendChar('-');
+            signedValue = -signedValue;
+        }
+
+        pEmitter->append("0x");
+        pEmitter->appendHex(static_cast<uint64_t>(signedValue));
+    }
+
+    void emitDecodedInstruction(SparkTextEmitter* pEmitter, const SparkDecodedBatch& pBatch, size_t pIdx)
+    {
+        const Cpu::SparkInstructionType& type = Cpu::gInstructionSet[pBatch.opcodes[pIdx]];
+
+        pEmitter->append(type.opcodeStr);
+
+        for (size_t i = 0; i < type.operandCount; i++)
+        {
+            pEmitter->append(i > 0 ? ", " : " ");
+
+            Reg operandValue = pBatch.operands[i][pIdx];
+            if (type.operandTypes[i] == Cpu::REGISTER)
+            {
+                pEmitter->append(Cpu::gRegisterNameTable[operandValue]);
+            }
+            else
+            {
+                emitImmediate(pEmitter, operandValue, type.operandLengths[i]);
+            }
+        }
+    }
+
+    // ' ; <instruction>\t<file offset>' aligned to SPARK_HEXDUMP_COLUMN
+    void emitHexdumpColumns(SparkTextEmitter* pEmitter, Reg pInstruction, size_t pFileOffset)
+    {
+        pEmitter->padToColumn(SPARK_HEXDUMP_COLUMN);
+        pEmitter->append(" ; ");
+        pEmitter->appendHex(pInstruction, 8);
+        pEmitter->appendChar('\t');
+        pEmitter->appendHex(pFileOffset, 8);
+    }
+
+    // words are read, decoded and emitted one window at a time so memory use does not grow with the input
+    constexpr size_t SPARK_DISASSEMBLY_WINDOW_WORDS = 1 << 16;
+    constexpr size_t SPARK_DISASSEMBLY_CHUNK_WORDS = 1 << 14;
+    constexpr size_t SPARK_DISASSEMBLY_CHUNKS_PER_THREAD = 4;
+    constexpr size_t SPARK_DISASSEMBLY_CHUNK_EMITTER_SIZE = 1 << 16;
+
+    // pPhases may be null, with it the hexdump columns are timed apart from the instruction text
+    void emitDecodedBatch(SparkTextEmitter* pEmitter, const SparkDecodedBatch& pBatch, const Reg* pInstructions, size_t pFirstWordIndex, bool pHexdump, Stats::SparkPhaseClock* pPhases)
+    {
+        for (size_t i = 0; i < pBatch.count(); i++)
+        {
+            emitDecodedInstruction(pEmitter, pBatch, i);
+
+            if (pHexdump)
+            {
+                Stats::SparkPhaseScope hexdump(pPhases, Stats::PHASE_HEXDUMP);
+                emitHexdumpColumns(pEmitter, pInstructions[i], (pFirstWordIndex + i) * sizeof(Reg));
+            }
+
+            pEmitter->endLine();
+        }
+    }
+
+    // one slice of a window, decoded and formatted by a single worker
+    typedef struct SparkDisassemblyChunk
+    {
+        Reg* instructions;
+        size_t firstWordIndex;
+        size_t wordCount;
+        SparkDecodedBatch decoded;
+        string text;
+    } SparkDisassemblyChunk;
+
+    // pStats and pTrace may be null
+    void disassembleChunk(SparkDisassemblyChunk* pChunk, bool pHexdump, ESparkEndianness pEndianness, Stats::SparkStats* pStats, Trace::SparkTraceRecorder* pTrace)
+    {
+        Stats::SparkPhaseClock phases;
+        phases.attach(pStats, pTrace);
+        phases.enter(Stats::PHASE_DECODE);
+
+        convertWords(pChunk->instructions, pChunk->instructions, pChunk->wordCount, pEndianness);
+
+        decodeBatch(span<const Reg>(pChunk->instructions, pChunk->wordCount), &pChunk->decoded);
+
+        pChunk->text.clear();
+        if (!pChunk->decoded.valid())
+        {
+            return;
+        }
+
+        phases.enter(Stats::PHASE_FORMAT);
+
+        SparkTextEmitter emitter(&pChunk->text, SPARK_DISASSEMBLY_CHUNK_EMITTER_SIZE);
+        emitDecodedBatch(&emitter, pChunk->decoded, pChunk->instructions, pChunk->firstWordIndex, pHexdump, &phases);
+    }
+
+    // same output as the serial path, chunks are formatted concurrently and written out in file order
+    bool disassembleStreamParallel(Cpu::SparkAssemblerContext* pCtx, FILE* pInput, SparkTextEmitter* pEmitter, bool pHexdump, ESparkEndianness pEndianness, SparkThreadPool* pPool, size_t* pOutFailedOffset)
+    {
+        size_t chunkCount = pPool->threadCount() * SPARK_DISASSEMBLY_CHUNKS_PER_THREAD;
+        size_t windowWords = chunkCount * SPARK_DISASSEMBLY_CHUNK_WORDS;
+
+        vector<Reg> window(windowWords);
+        Reg* instructions = window.data();
+
+        vector<SparkDisassemblyChunk> chunks(chunkCount);
+        size_t wordIndex = 0;
+
+        Stats::SparkPhaseClock& phases = pCtx->phases;
+        pEmitter->trackPhases(&phases);
+
+        while (true)
+        {
+            phases.enter(Stats::PHASE_READ);
+            size_t wordCount = fread(instructions, sizeof(Reg), windowWords, pInput);
+
+            if (wordCount == 0)
+            {
+                break;
+            }
+
+            size_t usedChunks = (wordCount + SPARK_DISASSEMBLY_CHUNK_WORDS - 1) / SPARK_DISASSEMBLY_CHUNK_WORDS;
+            for (size_t i = 0; i < usedChunks; i++)
+            {
+                size_t chunkStart = i * SPARK_DISASSEMBLY_CHUNK_WORDS;
+
+                chunks[i].instructions = instructions + chunkStart;
+                chunks[i].firstWordIndex = wordIndex + chunkStart;
+                chunks[i].wordCount = min(SPARK_DISASSEMBLY_CHUNK_WORDS, wordCount - chunkStart);
+            }
+
+            // the chunks time themselves
+            phases.enter(Stats::PHASE_IDLE);
+            pPool->parallelFor(usedChunks, [&](size_t pChunkIdx) { disassembleChunk(&chunks[pChunkIdx], pHexdump, pEndianness, pCtx->stats, pCtx->trace); });
+
+            phases.enter(Stats::PHASE_WRITE);
+            for (size_t i = 0; i < usedChunks; i++)
+            {
+                const SparkDisassemblyChunk& chunk = chunks[i];
+
+                if (!chunk.decoded.valid())
+                {
+                    reportInvalidInstruction(pCtx, chunk.instructions[chunk.decoded.firstInvalid]);
+                    *pOutFailedOffset = (chunk.firstWordIndex + chunk.decoded.firstInvalid) * sizeof(Reg);
+                    return false;
+                }
+
+                pEmitter->append(chunk.text);
+            }
+
+            wordIndex += wordCount;
+        }
+
+        if (ferror(pInput))
+        {
+            pCtx->error("Error reading the input file.\n");
+            *pOutFailedOffset = wordIndex * sizeof(Reg);
+            return false;
+        }
+
+        if (!pEmitter->flush())
+        {
+            pCtx->error("Error writing the output file.\n");
+            *pOutFailedOffset = wordIndex * sizeof(Reg);
+            return false;
+        }
+
+        if (pCtx->stats)
+        {
+            pCtx->stats->words += wordIndex;
+        }
+
+        pCtx->success();
+        return true;
+    }
+
+    // pInput holds words in pEndianness, a trailing partial word is ignored. on failure pOutFailedOffset is the file offset of the bad word
+    // pPool may be null, the window is then decoded on the calling thread
+    bool disassembleStream(Cpu::SparkAssemblerContext* pCtx, FILE* pInput, SparkTextEmitter* pEmitter, bool pHexdump, ESparkEndianness pEndianness, SparkThreadPool* pPool, size_t* pOutFailedOffset)
+    {
+        if (pPool && pPool->threadCount() > 1)
+        {
+            return disassembleStreamParallel(pCtx, pInput, pEmitter, pHexdump, pEndianness, pPool, pOutFailedOffset);
+        }
+
+        SafeList<Reg> window(SPARK_DISASSEMBLY_WINDOW_WORDS);
+        Reg* instructions = window.data();
+
+        SparkDecodedBatch decoded;
+        size_t wordIndex = 0;
+
+        Stats::SparkPhaseClock& phases = pCtx->phases;
+        pEmitter->trackPhases(&phases);
+
+        while (true)
+        {
+            phases.enter(Stats::PHASE_READ);
+            size_t wordCount = fread(instructions, sizeof(Reg), SPARK_DISASSEMBLY_WINDOW_WORDS, pInput);
+
+            if (wordCount == 0)
+            {
+                break;
+            }
+
+            phases.enter(Stats::PHASE_DECODE);
+            convertWords(instructions, instructions, wordCount, pEndianness);
+
+            decodeBatch(span<const Reg>(instructions, wordCount), &decoded);
+
+            if (!decoded.valid())
+            {
+                reportInvalidInstruction(pCtx, instructions[decoded.firstInvalid]);
+                *pOutFailedOffset = (wordIndex + decoded.firstInvalid) * sizeof(Reg);
+                return false;
+            }
+
+            phases.enter(Stats::PHASE_FORMAT);
+            emitDecodedBatch(pEmitter, decoded, instructions, wordIndex, pHexdump, &phases);
+            wordIndex += wordCount;
+        }
+
+        if (ferror(pInput))
+        {
+            pCtx->error("Error reading the input file.\n");
+            *pOutFailedOffset = wordIndex * sizeof(Reg);
+            return false;
+        }
+
+        if (!pEmitter->flush())
+        {
+            pCtx->error("Error writing the output file.\n");
+            *pOutFailedOffset = wordIndex * sizeof(Reg);
+            return false;
+        }
+
+        if (pCtx->stats)
+        {
+            pCtx->stats->words += wordIndex;
+        }
+
+        pCtx->success();
+        return true;
+    }
+
+    // pWords are already in memory and in host byte order. on failure pOutFailedIndex is the index of the bad word, or the
+    // word count if the output could not be written
+    bool disassembleWords(Cpu::SparkAssemblerContext* pCtx, span<const Reg> pWords, SparkTextEmitter* pEmitter, bool pHexdump, size_t* pOutFailedIndex)
+    {
+        SparkDecodedBatch decoded;
+
+        for (size_t wordIndex = 0; wordIndex < pWords.size(); wordIndex += SPARK_DISASSEMBLY_WINDOW_WORDS)
+        {
+            span<const Reg> window = pWords.subspan(wordIndex, min(SPARK_DISASSEMBLY_WINDOW_WORDS, pWords.size() - wordIndex));
+
+            decodeBatch(window, &decoded);
+
+            if (!decoded.valid())
+            {
+                reportInvalidInstruction(pCtx, window[decoded.firstInvalid]);
+                *pOutFailedIndex = wordIndex + decoded.firstInvalid;
+                return false;
+            }
+
+            emitDecodedBatch(pEmitter, decoded, window.data(), wordIndex, pHexdump, &pCtx->phases);
+        }
+
+        if (!pEmitter->flush())
+        {
+            pCtx->error("Error writing the output file.\n");
+            *pOutFailedIndex = pWords.size();
+            return false;
+        }
+
+        pCtx->success();
+        return true;
+    }
+}
@@ -0,0 +1,201 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "types.hpp"
+#include "stats.hpp"
+
+namespace SPARK
+{
+    constexpr size_t SPARK_EMITTER_BUFFER_SIZE = 1 << 20;
+
+    inline constexpr char gHexDigits[] = "0123456789ABCDEF";
+
+    // text goes into one fixed buffer that is written out in large chunks, memory use does not depend on the output size
+    typedef class SparkTextEmitter
+    {
+        FILE* sink = nullptr;
+        string* memorySink = nullptr;
+        span<char> bufferSink;
+        size_t written = 0;
+        char* buffer;
+        size_t capacity;
+        size_t used = 0;
+        size_t column = 0;
+        bool failed = false;
+
+        // writes to a file are timed as their own phase when set
+        Stats::SparkPhaseClock* phases = nullptr;
+
+    public:
+        explicit SparkTextEmitter(FILE* pSink, size_t pCapacity = SPARK_EMITTER_BUFFER_SIZE)
+        {
+            sink = pSink;
+            capacity = pCapacity;
+            buffer = new char[capacity];
+        }
+
+        // collects the text in memory, used by workers that format a part of the output out of order
+        explicit SparkTextEmitter(string* pSink, size_t pCapacity = SPARK_EMITTER_BUFFER_SIZE)
+        {
+            memorySink = pSink;
+            capacity = pCapacity;
+            buffer = new char[capacity];
+        }
+
+        // fills a caller owned buffer, text past its end is dropped but still counted by totalLength
+        explicit SparkTextEmitter(span<char> pSink, size_t pCapacity = SPARK_EMITTER_BUFFER_SIZE)
+        {
+            bufferSink = pSink;
+            capacity = pCapacity;
+            buffer = new char[capacity];
+        }
+
+        ~SparkTextEmitter()
+        {
+            flush();
+            delete[] buffer;
+        }
+
+        SparkTextEmitter(const SparkTextEmitter&) = delete;
+        SparkTextEmitter& operator=(const SparkTextEmitter&) = delete;
+
+    private:
+        void writeOut(const char* pData, size_t pLength)
+        {
+            if (memorySink)
+            {
+                memorySink->append(pData, pLength);
+            }
+            else if (bufferSink.data())
+            {
+                if (written < bufferSink.size())
+                {
+                    memcpy(bufferSink.data() + written, pData, min(pLength, bufferSink.size() - written));
+                }
+            }
+            else
+            {
+                Stats::SparkPhaseScope writing(phases, Stats::PHASE_WRITE);
+
+                if (fwrite(pData, 1, pLength, sink) != pLength)
+                {
+                    failed = true;
+                }
+            }
+
+            written += pLength;
+        }
+
+    public:
+
+        void trackPhases(Stats::SparkPhaseClock* pPhases)
+        {
+            phases = pPhases;
+        }
+
+        // returns false if any write so far has failed
+        bool flush()
+        {
+            if (used > 0)
+            {
+                writeOut(buffer, used);
+            }
+
+            used = 0;
+            return !failed;
+        }
+
+        // every character appended so far, flushed or not
+        size_t totalLength() const
+        {
+            return written + used;
+        }
+
+        void reserve(size_t pLength)
+        {
+            if (used + pLength > capacity)
+            {
+                flush();
+            }
+        }
+
+        void append(string_view pText)
+        {
+            column += pText.size();
+
+            if (pText.size() > capacity)
+            {
+                flush();
+                writeOut(pText.data(), pText.size());
+                return;
+            }
+
+            reserve(pText.size());
+            memcpy(buffer + used, pText.data(), pText.size());
+            used += pText.size();
+        }
+
+        void appendChar(char pChar)
+        {
+            reserve(1);
+            buffer[used++] = pChar;
+            column++;
+        }
+
+        void appendPadding(size_t pCount, char pChar = ' ')
+        {
+            while (pCount > 0)
+            {
+                reserve(1);
+
+                size_t chunk = pCount < capacity - used ? pCount : capacity - used;
+                memset(buffer + used, pChar, chunk);
+
+                used += chunk;
+                column += chunk;
+                pCount -= chunk;
+            }
+        }
+
+        void padToColumn(size_t pColumn)
+        {
+            if (column < pColumn)
+            {
+                appendPadding(pColumn - column);
+            }
+        }
+
+        // uppercase hex without a prefix, padded with zeros to at least pMinDigits
+        void appendHex(uint64_t pValue, size_t pMinDigits = 1)
+        {
+            char digits[16];
+            size_t digitCount = 0;
+
+            do
+            {
+                digits[15 - digitCount++] = gHexDigits[pValue & 0xF];
+                pValue >>= 4;
+            }
+            while (pValue != 0);
+
+            while (digitCount < pMinDigits && digitCount < 16)
+            {
+                digits[15 - digitCount++] = '0';
+            }
+
+            append(string_view(digits + 16 - digitCount, digitCount));
+        }
+
+        void endLine()
+        {
+            appendChar('\n');
+            column = 0;
+        }
+    } SparkTextEmitter;
+}
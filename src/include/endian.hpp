@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__AVX__)
+#include <immintrin.h>
+#define SPARK_BYTESWAP_SHUFFLE
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SPARK_BYTESWAP_NEON
+#endif
+
+#include "types.hpp"
+
+namespace SPARK
+{
+    // byte order of the words in an image file, the assembler works on words in host byte order and only converts at the edges
+    enum ESparkEndianness
+    {
+        INVENDIAN = -1,
+        ENDIAN_BIG,
+        ENDIAN_LITTLE
+    };
+
+    ESparkEndianness argToEndianness(string_view pArg)
+    {
+        if (pArg == "big" || pArg == "BIG" || pArg == "be")
+        {
+            return ENDIAN_BIG;
+        }
+
+        if (pArg == "little" || pArg == "LITTLE" || pArg == "le")
+        {
+            return ENDIAN_LITTLE;
+        }
+
+        return INVENDIAN;
+    }
+
+    // whether words have to be swapped between host byte order and pEndianness
+    constexpr bool needsByteswap(ESparkEndianness pEndianness)
+    {
+        return (pEndianness == ENDIAN_BIG) != (endian::native == endian::big);
+    }
+
+    constexpr Reg byteswapWord(Reg pWord)
+    {
+        return std::byteswap(pWord);
+    }
+
+    // reverses the bytes of every word from pSource into pDestination, the two may be the same buffer. 8 or 4 words per step
+    // with a byte shuffle where the target has one, the tail and other targets go word by word
+    void byteswapWords(const Reg* pSource, Reg* pDestination, size_t pCount)
+    {
+        size_t i = 0;
+
+#if defined(SPARK_BYTESWAP_SHUFFLE) && defined(__AVX2__)
+        const __m256i reverse8 = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+        for (; i + 8 <= pCount; i += 8)
+        {
+            __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDestination + i), _mm256_shuffle_epi8(words, reverse8));
+        }
+#endif
+
+#if defined(SPARK_BYTESWAP_SHUFFLE)
+        const __m128i reverse4 = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+        for (; i + 4 <= pCount; i += 4)
+        {
+            __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDestination + i), _mm_shuffle_epi8(words, reverse4));
+        }
+#elif defined(SPARK_BYTESWAP_NEON)
+        for (; i + 4 <= pCount; i += 4)
+        {
+            uint8x16_t words = vld1q_u8(reinterpret_cast<const uint8_t*>(pSource + i));
+            vst1q_u8(reinterpret_cast<uint8_t*>(pDestination + i), vrev32q_u8(words));
+        }
+#endif
+
+        for (; i < pCount; i++)
+        {
+            pDestination[i] = byteswapWord(pSource[i]);
+        }
+    }
+
+    // host byte order to pEndianness or back, the conversion is its own inverse
+    void convertWords(const Reg* pSource, Reg* pDestination, size_t pCount, ESparkEndianness pEndianness)
+    {
+        if (needsByteswap(pEndianness))
+        {
+            byteswapWords(pSource, pDestination, pCount);
+        }
+        else if (pSource != pDestination)
+        {
+            memcpy(pDestination, pSource, pCount * sizeof(Reg));
+        }
+    }
+}
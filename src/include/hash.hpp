@@ -0,0 +1,179 @@
+﻿#pragma once
+
+#include <bit>
+#include <string_view>
+
+#include "types.hpp"
+
+namespace SPARK
+{
+    // xxh64, incremental so a program spread over several files hashes without being copied into one buffer
+    typedef class SparkHasher
+    {
+        static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+        static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+        static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+        static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+        static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+        static constexpr size_t STRIPE_SIZE = 32;
+
+        uint64_t seed;
+        uint64_t lanes[4];
+        uint64_t totalLength = 0;
+        char stripe[STRIPE_SIZE] = {};
+        size_t stripeUsed = 0;
+
+        // byte by byte so the hasher also works in constant expressions, compilers fold it into a single load
+        static constexpr uint64_t readLittleEndian(const char* pData, size_t pLength)
+        {
+            uint64_t value = 0;
+            for (size_t i = 0; i < pLength; i++)
+            {
+                value |= static_cast<uint64_t>(static_cast<unsigned char>(pData[i])) << (i * 8);
+            }
+            return value;
+        }
+
+        static constexpr uint64_t round(uint64_t pAccumulator, uint64_t pInput)
+        {
+            pAccumulator += pInput * PRIME2;
+            pAccumulator = rotl(pAccumulator, 31);
+            return pAccumulator * PRIME1;
+        }
+
+        static constexpr uint64_t mergeRound(uint64_t pAccumulator, uint64_t pLane)
+        {
+            pAccumulator ^= round(0, pLane);
+            return pAccumulator * PRIME1 + PRIME4;
+        }
+
+        constexpr void consumeStripe(const char* pData)
+        {
+            for (size_t i = 0; i < 4; i++)
+            {
+                lanes[i] = round(lanes[i], readLittleEndian(pData + i * 8, 8));
+            }
+        }
+
+    public:
+        constexpr explicit SparkHasher(uint64_t pSeed = 0)
+        {
+            seed = pSeed;
+            lanes[0] = pSeed + PRIME1 + PRIME2;
+            lanes[1] = pSeed + PRIME2;
+            lanes[2] = pSeed;
+            lanes[3] = pSeed - PRIME1;
+        }
+
+        constexpr void update(string_view pData)
+        {
+            totalLength += pData.size();
+
+            const char* data = pData.data();
+            size_t length = pData.size();
+
+            if (stripeUsed > 0)
+            {
+                size_t fill = STRIPE_SIZE - stripeUsed < length ? STRIPE_SIZE - stripeUsed : length;
+                for (size_t i = 0; i < fill; i++)
+                {
+                    stripe[stripeUsed + i] = data[i];
+                }
+
+                stripeUsed += fill;
+                data += fill;
+                length -= fill;
+
+                if (stripeUsed < STRIPE_SIZE)
+                {
+                    return;
+                }
+
+                consumeStripe(stripe);
+                stripeUsed = 0;
+            }
+
+            while (length >= STRIPE_SIZE)
+            {
+                consumeStripe(data);
+                data += STRIPE_SIZE;
+                length -= STRIPE_SIZE;
+            }
+
+            for (size_t i = 0; i < length; i++)
+            {
+                stripe[i] = data[i];
+            }
+            stripeUsed = length;
+        }
+
+        constexpr void updateValue(uint64_t pValue)
+        {
+            char bytes[8] = {};
+            for (size_t i = 0; i < 8; i++)
+            {
+                bytes[i] = static_cast<char>(pValue >> (i * 8));
+            }
+            update(string_view(bytes, 8));
+        }
+
+        constexpr uint64_t digest() const
+        {
+            uint64_t hash;
+
+            if (totalLength >= STRIPE_SIZE)
+            {
+                hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+                for (uint64_t lane : lanes)
+                {
+                    hash = mergeRound(hash, lane);
+                }
+            }
+            else
+            {
+                hash = seed + PRIME5;
+            }
+
+            hash += totalLength;
+
+            size_t offset = 0;
+            for (; offset + 8 <= stripeUsed; offset += 8)
+            {
+                hash ^= round(0, readLittleEndian(stripe + offset, 8));
+                hash = rotl(hash, 27) * PRIME1 + PRIME4;
+            }
+
+            if (offset + 4 <= stripeUsed)
+            {
+                hash ^= readLittleEndian(stripe + offset, 4) * PRIME1;
+                hash = rotl(hash, 23) * PRIME2 + PRIME3;
+                offset += 4;
+            }
+
+            for (; offset < stripeUsed; offset++)
+            {
+                hash ^= static_cast<unsigned char>(stripe[offset]) * PRIME5;
+                hash = rotl(hash, 11) * PRIME1;
+            }
+
+            hash ^= hash >> 33;
+            hash *= PRIME2;
+            hash ^= hash >> 29;
+            hash *= PRIME3;
+            hash ^= hash >> 32;
+
+            return hash;
+        }
+    } SparkHasher;
+
+    constexpr uint64_t hashBytes(string_view pData, uint64_t pSeed = 0)
+    {
+        SparkHasher hasher(pSeed);
+        hasher.update(pData);
+        return hasher.digest();
+    }
+
+    static_assert(hashBytes("") == 0xEF46DB3751D8E999ull);
+    static_assert(hashBytes("abc") == 0x44BC2CF5AD770999ull);
+}
@@ -0,0 +1,152 @@
+﻿#pragma once
+
+#include <array>
+#include <cstdint>
+#include <format>
+#include <vector>
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "isa.hpp"
+#include "symbols.hpp"
+#include "threadPool.hpp"
+#include "trace.hpp"
+
+namespace SPARK::Assembler::IR
+{
+    enum ESparkInstructionFlags : uint8_t
+    {
+        INSTRUCTION_NONE = 0,
+        // expanded from a macro
+        INSTRUCTION_MACRO = 1 << 0,
+        // one operand is a label that was not resolved while parsing, see the fixups of the context
+        INSTRUCTION_LABEL_OPERAND = 1 << 1,
+    };
+
+    // the program between parsing and encoding, one row per instruction and one column per field. row i becomes word i,
+    // passes patch columns in place instead of decoding and re-encoding words
+    typedef struct SparkProgramIR
+    {
+        vector<uint8_t> opcodes;
+        // operands past the operand count of the opcode are 0
+        array<vector<Reg>, Cpu::SPARK_MAX_OPERANDS> operands;
+        vector<uint8_t> flags;
+
+        // new rows are zeroed, parsing chunks then fill disjoint ranges
+        void resize(size_t pCount)
+        {
+            opcodes.resize(pCount);
+            flags.resize(pCount);
+
+            for (vector<Reg>& column : operands)
+            {
+                column.resize(pCount);
+            }
+        }
+
+        size_t size() const
+        {
+            return opcodes.size();
+        }
+    } SparkProgramIR;
+
+    // shift and mask of every operand field, indexed by operand then opcode. fields an opcode does not have, and opcodes
+    // that do not exist, have mask 0 and add nothing to the word
+    typedef struct SparkEncodingTables
+    {
+        array<array<Reg, 64>, Cpu::SPARK_MAX_OPERANDS> shifts{};
+        array<array<Reg, 64>, Cpu::SPARK_MAX_OPERANDS> masks{};
+    } SparkEncodingTables;
+
+    constexpr SparkEncodingTables buildEncodingTables()
+    {
+        SparkEncodingTables tables;
+
+        for (size_t opcode = 0; opcode < Cpu::gInstructionSet.size(); opcode++)
+        {
+            const Cpu::SparkInstructionType& type = Cpu::gInstructionSet[opcode];
+
+            for (size_t operandIdx = 0; operandIdx < type.operandCount; operandIdx++)
+            {
+                size_t length = type.operandLengths[operandIdx];
+
+                tables.shifts[operandIdx][opcode] = type.operandShifts[operandIdx];
+                tables.masks[operandIdx][opcode] = length >= 32 ? ~0u : (1u << length) - 1;
+            }
+        }
+
+        return tables;
+    }
+
+    inline constexpr SparkEncodingTables gEncodingTables = buildEncodingTables();
+
+    // rows of at most this many instructions are encoded by one task
+    constexpr size_t SPARK_ENCODE_KERNEL_ROWS = 1 << 14;
+
+    // rows [pBegin, pEnd) to words in host byte order. no branches and no per opcode calls, the compiler turns the loop into vector
+    // code with the table lookups as gathers
+    void encodeRows(const SparkProgramIR& pIR, size_t pBegin, size_t pEnd, Reg* pOutWords)
+    {
+        const uint8_t* opcodes = pIR.opcodes.data();
+        const Reg* operands0 = pIR.operands[0].data();
+        const Reg* operands1 = pIR.operands[1].data();
+        const Reg* operands2 = pIR.operands[2].data();
+
+        const auto& shifts = gEncodingTables.shifts;
+        const auto& masks = gEncodingTables.masks;
+
+        static_assert(Cpu::SPARK_MAX_OPERANDS == 3, "encodeRows reads one column per operand.");
+
+        for (size_t i = pBegin; i < pEnd; i++)
+        {
+            uint8_t opcode = opcodes[i] & 63;
+
+            Reg word = static_cast<Reg>(opcode) << 26;
+            word |= (operands0[i] & masks[0][opcode]) << shifts[0][opcode];
+            word |= (operands1[i] & masks[1][opcode]) << shifts[1][opcode];
+            word |= (operands2[i] & masks[2][opcode]) << shifts[2][opcode];
+
+            pOutWords[i] = word;
+        }
+    }
+
+    // pOutWords holds pIR.size() words, pPool and pTrace may be null
+    void encodeProgram(const SparkProgramIR& pIR, Reg* pOutWords, SparkThreadPool* pPool, Trace::SparkTraceRecorder* pTrace)
+    {
+        size_t blockCount = (pIR.size() + SPARK_ENCODE_KERNEL_ROWS - 1) / SPARK_ENCODE_KERNEL_ROWS;
+
+        auto encodeBlock = [&](size_t pBlockIdx)
+        {
+            Trace::SparkTraceScope span(pTrace, "chunk", "encode block");
+
+            size_t begin = pBlockIdx * SPARK_ENCODE_KERNEL_ROWS;
+            encodeRows(pIR, begin, min(begin + SPARK_ENCODE_KERNEL_ROWS, pIR.size()), pOutWords);
+        };
+
+        if (pPool && blockCount > 1)
+        {
+            pPool->parallelFor(blockCount, encodeBlock);
+            return;
+        }
+
+        for (size_t i = 0; i < blockCount; i++)
+        {
+            encodeBlock(i);
+        }
+    }
+
+    // relocation pass, writes the pc relative offset of the label into the operand column the fixup was recorded for
+    void resolveFixup(Cpu::SparkAssemblerContext* pCtx, const Cpu::SparkAssemblerFixup& pFixup, SparkProgramIR* pIR)
+    {
+        Cpu::SparkAssemblerLabel* label = pCtx->findLabel(pFixup.labelName);
+        if (!label)
+        {
+            pCtx->error(format("Unresolved label '{0}'.\n", pFixup.labelName));
+            return;
+        }
+
+        pIR->operands[pFixup.operandIndex][pFixup.wordIndex] = label->offset - pFixup.instructionOffset;
+
+        pCtx->success();
+    }
+}
@@ -0,0 +1,173 @@
+﻿#pragma once
+
+#include <array>
+#include <string_view>
+
+#include "types.hpp"
+#include "cpu.hpp"
+#include "hash.hpp"
+#include "perfectHash.hpp"
+
+namespace SPARK::Cpu
+{
+#define OPTYPE(operandType, bitLength) Cpu::SparkOperandField{Cpu::operandType, bitLength}
+#define SPARK_INSTRUCTION(opcodeStr, opcodeId, ...) SparkInstructionType::describe<SparkInstructionEncoding<opcodeId, __VA_ARGS__>>(opcodeStr)
+
+    // the whole isa, the encode and decode tables and every lookup table below are generated from this and the macro table
+    inline constexpr array<SparkInstructionType, 8> gInstructionTypes = {
+        SPARK_INSTRUCTION("liw", LIW, OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16), OPTYPE(IMMEDIATE, 1)),
+        SPARK_INSTRUCTION("addi", ADDI, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16)),
+        SPARK_INSTRUCTION("add", ADD, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5)),
+        SPARK_INSTRUCTION("mov", MOV, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5)),
+        SPARK_INSTRUCTION("cmpr", CMPR, OPTYPE(REGISTER, 5), OPTYPE(REGISTER, 5)),
+        SPARK_INSTRUCTION("cmpi", CMPI, OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16)),
+        SPARK_INSTRUCTION("jmpcr", JMPCR, OPTYPE(REGISTER, 5), OPTYPE(IMMEDIATE, 16)),
+        SPARK_INSTRUCTION("jmp", JMP, OPTYPE(REGISTER, 5)),
+    };
+
+    // ordered by ESparkInstructionMacroOpcodeId, the count is the number of operands the expander reads
+    inline constexpr array<SparkInstructionMacroType, 11> gMacroInstructionSet = {{
+        {"inc", INC, ADDI, 1, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), OP(0), 1)},
+
+        {"liwl", LIWL, LIW, 2, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), OP(1), 0)},
+        {"liwh", LIWH, LIW, 2, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), OP(1), 1)},
+
+        {"jmpeq", JMPEQ, JMPCR, 1, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::EQUAL)},
+        {"jmpl", JMPL, JMPCR, 1, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::LESS)},
+        {"jmpleq", JMPLEQ, JMPCR, 1, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::LESS_OR_EQUAL)},
+        {"jmpg", JMPG, JMPCR, 1, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::GREATER)},
+        {"jmpgeq", JMPGEQ, JMPCR, 1, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::GREATER_OR_EQUAL)},
+
+        {"labreg", LABREG, ADDI, 2, SPARK_INSTRUCTION_MACRO_EXPAND(OP(0), Cpu::PC, x->labelOffsetFromCurrentInstruction(RAWOP(1), 2))},
+        {"labjmp", LABJMP, ADDI, 1, SPARK_INSTRUCTION_MACRO_EXPAND(Cpu::JR, Cpu::PC, x->labelOffsetFromCurrentInstruction(RAWOP(0), 2))},
+
+        {"ret", RET, JMP, 0, SPARK_INSTRUCTION_MACRO_EXPAND(Cpu::RETADDR)},
+    }};
+
+    constexpr array<SparkInstructionType, 64> indexInstructionTypes()
+    {
+        array<SparkInstructionType, 64> instructionSet{};
+
+        for (const SparkInstructionType& type : gInstructionTypes)
+        {
+            instructionSet[type.opcodeId] = type;
+        }
+
+        return instructionSet;
+    }
+
+    constexpr bool macroTableIsOrdered()
+    {
+        for (size_t i = 0; i < gMacroInstructionSet.size(); i++)
+        {
+            if (gMacroInstructionSet[i].opcodeId != static_cast<ESparkInstructionMacroOpcodeId>(i))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static_assert(macroTableIsOrdered(), "gMacroInstructionSet must be ordered by ESparkInstructionMacroOpcodeId.");
+
+    // indexed by the 6 bit opcode, unused opcodes have opcodeId INVOP
+    inline constexpr array<SparkInstructionType, 64> gInstructionSet = indexInstructionTypes();
+
+    constexpr array<SparkPerfectHashEntry<ESparkInstructionOpcodeId>, gInstructionTypes.size()> opcodeHashEntries()
+    {
+        array<SparkPerfectHashEntry<ESparkInstructionOpcodeId>, gInstructionTypes.size()> entries{};
+
+        for (size_t i = 0; i < gInstructionTypes.size(); i++)
+        {
+            entries[i] = {gInstructionTypes[i].opcodeStr, gInstructionTypes[i].opcodeId};
+        }
+
+        return entries;
+    }
+
+    constexpr array<SparkPerfectHashEntry<ESparkInstructionMacroOpcodeId>, gMacroInstructionSet.size()> macroHashEntries()
+    {
+        array<SparkPerfectHashEntry<ESparkInstructionMacroOpcodeId>, gMacroInstructionSet.size()> entries{};
+
+        for (size_t i = 0; i < gMacroInstructionSet.size(); i++)
+        {
+            entries[i] = {gMacroInstructionSet[i].opcode, gMacroInstructionSet[i].opcodeId};
+        }
+
+        return entries;
+    }
+
+    inline constexpr SparkPerfectHashTable gOpcodeLookup(opcodeHashEntries(), INVOP);
+    inline constexpr SparkPerfectHashTable gMacroLookup(macroHashEntries(), INVMACRO);
+
+    // macro expansions are code and can not be hashed, bump this whenever one of them changes what it emits
+    constexpr uint64_t SPARK_ISA_REVISION = 1;
+
+    constexpr uint64_t computeIsaVersion()
+    {
+        SparkHasher hasher(SPARK_ISA_REVISION);
+
+        for (const SparkInstructionType& instructionType : gInstructionTypes)
+        {
+            hasher.update(instructionType.opcodeStr);
+            hasher.updateValue(instructionType.opcodeId);
+            hasher.updateValue(instructionType.operandCount);
+
+            for (size_t i = 0; i < instructionType.operandCount; i++)
+            {
+                hasher.updateValue(instructionType.operandTypes[i]);
+                hasher.updateValue(instructionType.operandLengths[i]);
+                hasher.updateValue(instructionType.operandShifts[i]);
+            }
+        }
+
+        for (const SparkInstructionMacroType& macroType : gMacroInstructionSet)
+        {
+            hasher.update(macroType.opcode);
+            hasher.updateValue(macroType.opcodeId);
+            hasher.updateValue(macroType.baseOpcodeId);
+            hasher.updateValue(macroType.operandCount);
+        }
+
+        for (string_view registerName : gRegisterNameTable)
+        {
+            hasher.update(registerName);
+        }
+
+        return hasher.digest();
+    }
+
+    // changes whenever the tables above change, anything cached from encoded output is keyed on it
+    inline constexpr uint64_t gIsaVersion = computeIsaVersion();
+
+    ESparkInstructionOpcodeId getOpcodeIdFromOpcodeStr(string_view pOpcodeStr)
+    {
+        return gOpcodeLookup.find(pOpcodeStr);
+    }
+
+    ESparkInstructionMacroOpcodeId getMacroOpcodeIdFromOpcodeStr(string_view pOpcodeStr)
+    {
+        return gMacroLookup.find(pOpcodeStr);
+    }
+
+    const SparkInstructionMacroType* getMacroTypeFromId(ESparkInstructionMacroOpcodeId pOpcodeId)
+    {
+        if (pOpcodeId < 0 || static_cast<size_t>(pOpcodeId) >= gMacroInstructionSet.size())
+        {
+            return nullptr;
+        }
+
+        return &gMacroInstructionSet[pOpcodeId];
+    }
+
+    const SparkInstructionType* getInstructionTypeFromOpcodeId(ESparkInstructionOpcodeId pOpcodeId)
+    {
+        if (pOpcodeId < 0 || pOpcodeId >= 64 || gInstructionSet[pOpcodeId].opcodeId == INVOP)
+        {
+            return nullptr;
+        }
+
+        return &gInstructionSet[pOpcodeId];
+    }
+}
@@ -0,0 +1,226 @@
+﻿#pragma once
+
+#include <string_view>
+
+#include "types.hpp"
+
+namespace SPARK::Assembler::Lexer
+{
+    // mnemonic + 3 operands is the widest line in the isa, the rest is headroom for error reporting
+    constexpr size_t SPARK_MAX_LINE_TOKENS = 8;
+
+    enum ESparkTokenKind
+    {
+        INV_TOKEN = -1,
+        // 'addi' in 'addi r1, r2, 4'
+        MNEMONIC,
+        // 'r2' in 'addi r1, r2, 4'
+        OPERAND,
+        // 'loop' in 'labreg r1, 'loop''
+        QUOTED_OPERAND,
+        // 'loop' in 'loop:'
+        LABEL_NAME,
+        // 'counter' in 'counter = r3'
+        MACRO_NAME,
+        // 'r3' in 'counter = r3'
+        MACRO_VALUE,
+        // '#include' in '#include 'stdlib.spark''
+        DIRECTIVE,
+        // 'stdlib.spark' in '#include 'stdlib.spark''
+        DIRECTIVE_ARGUMENT,
+    };
+
+    typedef struct SparkToken
+    {
+        ESparkTokenKind kind;
+        string_view text;
+    } SparkToken;
+
+    // tokens are views into the line that was tokenized, they are only valid as long as it is
+    typedef struct SparkLineTokens
+    {
+        SparkToken tokens[SPARK_MAX_LINE_TOKENS];
+        size_t count = 0;
+        bool overflow = false;
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        ESparkTokenKind leadingKind() const
+        {
+            return count == 0 ? INV_TOKEN : tokens[0].kind;
+        }
+
+        bool hasDirective(string_view pDirective) const
+        {
+            return leadingKind() == DIRECTIVE && tokens[0].text == pDirective;
+        }
+
+        string_view directiveArgument() const
+        {
+            if (count < 2 || tokens[1].kind != DIRECTIVE_ARGUMENT)
+            {
+                return {};
+            }
+
+            return tokens[1].text;
+        }
+
+        bool isPragmaOnce() const
+        {
+            return hasDirective("#pragma") && directiveArgument() == "once";
+        }
+
+        const SparkToken& operator[](size_t pIdx) const
+        {
+            return tokens[pIdx];
+        }
+    } SparkLineTokens;
+
+    bool humanChar(unsigned char pChar)
+    {
+        return pChar >= 0x20 && pChar <= 0x82;
+    }
+
+    bool blankChar(unsigned char pChar)
+    {
+        return pChar == ' ' || !humanChar(pChar);
+    }
+
+    string_view trimBlanks(string_view pText)
+    {
+        size_t begin = 0;
+        size_t end = pText.size();
+
+        while (begin < end && blankChar(pText[begin]))
+        {
+            begin++;
+        }
+
+        while (end > begin && blankChar(pText[end - 1]))
+        {
+            end--;
+        }
+
+        return pText.substr(begin, end - begin);
+    }
+
+    void pushToken(SparkLineTokens* pTokens, ESparkTokenKind pKind, string_view pText)
+    {
+        if (pTokens->count == SPARK_MAX_LINE_TOKENS)
+        {
+            pTokens->overflow = true;
+            return;
+        }
+
+        pTokens->tokens[pTokens->count++] = {pKind, pText};
+    }
+
+    string_view unquote(string_view pText)
+    {
+        if (pText.size() >= 2 && pText.front() == '\'' && pText.back() == '\'')
+        {
+            return pText.substr(1, pText.size() - 2);
+        }
+
+        return pText;
+    }
+
+    // true if the first non blank character is '#', lines without a directive need no tokens while includes are expanded
+    bool startsWithDirective(string_view pLine)
+    {
+        for (char c : pLine)
+        {
+            if (!blankChar(c))
+            {
+                return c == '#';
+            }
+        }
+
+        return false;
+    }
+
+    // walks the line once, everything after ';' is a comment
+    void tokenizeAssemblyLine(string_view pLine, SparkLineTokens* pOutTokens)
+    {
+        pOutTokens->count = 0;
+        pOutTokens->overflow = false;
+
+        string_view line = trimBlanks(pLine.substr(0, pLine.find(';')));
+
+        if (line.empty())
+        {
+            return;
+        }
+
+        if (line[0] == '#')
+        {
+            size_t directiveEnd = 1;
+            while (directiveEnd < line.size() && !blankChar(line[directiveEnd]) && line[directiveEnd] != '\'')
+            {
+                directiveEnd++;
+            }
+
+            pushToken(pOutTokens, DIRECTIVE, line.substr(0, directiveEnd));
+
+            string_view argument = trimBlanks(line.substr(directiveEnd));
+            if (!argument.empty())
+            {
+                pushToken(pOutTokens, DIRECTIVE_ARGUMENT, unquote(argument));
+            }
+
+            return;
+        }
+
+        size_t wordEnd = 0;
+        while (wordEnd < line.size())
+        {
+            char currentChar = line[wordEnd];
+            if (blankChar(currentChar) || currentChar == ':' || currentChar == '=' || currentChar == ',')
+            {
+                break;
+            }
+
+            wordEnd++;
+        }
+
+        string_view word = line.substr(0, wordEnd);
+        string_view rest = trimBlanks(line.substr(wordEnd));
+
+        if (!word.empty() && !rest.empty())
+        {
+            if (rest[0] == ':')
+            {
+                pushToken(pOutTokens, LABEL_NAME, word);
+                return;
+            }
+
+            if (rest[0] == '=')
+            {
+                pushToken(pOutTokens, MACRO_NAME, word);
+                pushToken(pOutTokens, MACRO_VALUE, trimBlanks(rest.substr(1)));
+                return;
+            }
+        }
+
+        pushToken(pOutTokens, MNEMONIC, word);
+
+        while (!rest.empty())
+        {
+            size_t commaOffset = rest.find(',');
+            string_view operand = trimBlanks(rest.substr(0, commaOffset));
+            string_view unquoted = unquote(operand);
+
+            pushToken(pOutTokens, unquoted.size() == operand.size() ? OPERAND : QUOTED_OPERAND, unquoted);
+
+            if (commaOffset == string_view::npos)
+            {
+                break;
+            }
+
+            rest = rest.substr(commaOffset + 1);
+        }
+    }
+}
@@ -1,5 +1,8 @@
 ﻿#pragma once
+#include <format>
+#include <iterator>
 #include <print>
+#include <string>
 
 //Regular text
 #define CLR_FRBLK "\x1b[0;30m"
@@ -77,7 +80,25 @@
 #define STRINGIZE2(x) #x
 #define LINE_STRING STRINGIZE(__LINE__)
 
-#define LOGRAW(fmt, ...) print("[" __FILE__ ":" LINE_STRING "] - " fmt, __VA_ARGS__)
+namespace SPARK
+{
+    // set by a thread whose log output belongs to someone else, a server collects it for the client that sent the request
+    inline thread_local std::string* tLogCapture = nullptr;
+
+    template <typename... Args>
+    void logPrint(std::format_string<Args...> pFormat, Args&&... pArgs)
+    {
+        if (tLogCapture)
+        {
+            std::format_to(std::back_inserter(*tLogCapture), pFormat, std::forward<Args>(pArgs)...);
+            return;
+        }
+
+        std::print(pFormat, std::forward<Args>(pArgs)...);
+    }
+}
+
+#define LOGRAW(fmt, ...) SPARK::logPrint("[" __FILE__ ":" LINE_STRING "] - " fmt, __VA_ARGS__)
 #define LOGERR(fmt, ...) LOGRAW(CLR_FRRED fmt CLR_RESET, __VA_ARGS__)
 #define LOGWRN(fmt, ...) LOGRAW(CLR_FRYEL fmt CLR_RESET, __VA_ARGS__)
 #define LOGINF(fmt, ...) LOGRAW(CLR_FBWHT fmt CLR_RESET, __VA_ARGS__)
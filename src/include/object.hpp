@@ -0,0 +1,204 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "assembler.hpp"
+#include "binaryFile.hpp"
+#include "cpu.hpp"
+#include "isa.hpp"
+#include "output.hpp"
+#include "symbols.hpp"
+
+namespace SPARK::Assembler::Object
+{
+    constexpr uint32_t SPARK_OBJECT_MAGIC = 0x4F4B5053; // "SPKO"
+    // 2: words are stored in host byte order
+    constexpr uint32_t SPARK_OBJECT_FORMAT_VERSION = 2;
+
+    // one assembled source file. symbol offsets and relocation word indices are relative to the start of the object,
+    // relocations are the pc relative label fields that refer to symbols of other objects and keep their source line for diagnostics
+    typedef struct SparkObjectFile
+    {
+        vector<Reg> words;
+        vector<Cpu::SparkAssemblerLabel> symbols;
+        vector<Cpu::SparkAssemblerFixup> relocations;
+    } SparkObjectFile;
+
+    // replaces pPath only once the whole object is written
+    bool writeObjectFile(const string& pPath, const SparkObjectFile& pObject)
+    {
+        SparkOutputFile output(pPath);
+
+        FILE* fp = fopen(output.writePath().c_str(), "wb");
+        if (!fp)
+        {
+            return false;
+        }
+
+        bool written = writeValue(fp, SPARK_OBJECT_MAGIC) && writeValue(fp, SPARK_OBJECT_FORMAT_VERSION) && writeValue(fp, Cpu::gIsaVersion);
+        written = written && writeValue(fp, static_cast<uint32_t>(pObject.words.size()));
+        written = written && writeValue(fp, static_cast<uint32_t>(pObject.symbols.size()));
+        written = written && writeValue(fp, static_cast<uint32_t>(pObject.relocations.size()));
+        written = written && fwrite(pObject.words.data(), sizeof(Reg), pObject.words.size(), fp) == pObject.words.size();
+
+        for (const Cpu::SparkAssemblerLabel& symbol : pObject.symbols)
+        {
+            written = written && writeValue(fp, symbol.offset) && writeString(fp, symbol.name);
+        }
+
+        for (const Cpu::SparkAssemblerFixup& relocation : pObject.relocations)
+        {
+            written = written && writeValue(fp, static_cast<uint32_t>(relocation.wordIndex));
+            written = written && writeValue(fp, relocation.fieldShift) && writeValue(fp, relocation.fieldMask);
+            written = written && writeString(fp, relocation.labelName);
+            written = written && writeString(fp, relocation.file) && writeValue(fp, static_cast<uint32_t>(relocation.lineNumber)) && writeString(fp, relocation.lineContents);
+        }
+
+        written = output.close(fp) && written;
+
+        return written && output.commit();
+    }
+
+    void readObjectFile(Cpu::SparkAssemblerContext* pCtx, const string& pPath, SparkObjectFile* pOutObject)
+    {
+        FILE* fp = fopen(pPath.c_str(), "rb");
+        if (!fp)
+        {
+            pCtx->error(format("Could not open object file '{0}'.\n", pPath));
+            return;
+        }
+
+        uint32_t magic = 0;
+        uint32_t formatVersion = 0;
+        uint64_t isaVersion = 0;
+        uint32_t wordCount = 0;
+        uint32_t symbolCount = 0;
+        uint32_t relocationCount = 0;
+
+        bool valid = readValue(fp, &magic) && readValue(fp, &formatVersion) && readValue(fp, &isaVersion);
+        valid = valid && readValue(fp, &wordCount) && readValue(fp, &symbolCount) && readValue(fp, &relocationCount);
+
+        if (!valid || magic != SPARK_OBJECT_MAGIC || formatVersion != SPARK_OBJECT_FORMAT_VERSION)
+        {
+            fclose(fp);
+            pCtx->error(format("'{0}' is not an object file of this assembler version.\n", pPath));
+            return;
+        }
+
+        if (isaVersion != Cpu::gIsaVersion)
+        {
+            fclose(fp);
+            pCtx->error(format("Object file '{0}' was assembled for a different instruction set, assemble it again.\n", pPath));
+            return;
+        }
+
+        // objects come from other builds, counts that promise more than the file holds are damage and nothing is allocated
+        // for them. a symbol takes at least its offset and name length, a relocation its fixed fields and three string lengths
+        uint64_t objectBytes = fileByteCount(fp);
+        uint64_t headerBytes = sizeof(magic) + sizeof(formatVersion) + sizeof(isaVersion) + sizeof(wordCount) + sizeof(symbolCount) + sizeof(relocationCount);
+        uint64_t symbolBytes = sizeof(Reg) + sizeof(uint32_t);
+        uint64_t relocationBytes = sizeof(uint32_t) + sizeof(Cpu::SparkAssemblerFixup::fieldShift) + sizeof(Cpu::SparkAssemblerFixup::fieldMask) + 4 * sizeof(uint32_t);
+        uint64_t promisedBytes = uint64_t(wordCount) * sizeof(Reg) + uint64_t(symbolCount) * symbolBytes + uint64_t(relocationCount) * relocationBytes;
+
+        valid = objectBytes >= headerBytes && promisedBytes <= objectBytes - headerBytes;
+
+        if (valid)
+        {
+            pOutObject->words.resize(wordCount);
+            valid = fread(pOutObject->words.data(), sizeof(Reg), wordCount, fp) == wordCount;
+        }
+
+        for (uint32_t i = 0; valid && i < symbolCount; i++)
+        {
+            Reg offset = 0;
+            string name;
+
+            valid = readValue(fp, &offset) && readString(fp, &name, objectBytes);
+            pOutObject->symbols.emplace_back(offset, name);
+        }
+
+        for (uint32_t i = 0; valid && i < relocationCount; i++)
+        {
+            uint32_t wordIndex = 0;
+            uint32_t lineNumber = 0;
+            Cpu::SparkAssemblerFixup relocation{};
+
+            valid = readValue(fp, &wordIndex) && readValue(fp, &relocation.fieldShift) && readValue(fp, &relocation.fieldMask);
+            valid = valid && readString(fp, &relocation.labelName, objectBytes) && readString(fp, &relocation.file, objectBytes);
+            valid = valid && readValue(fp, &lineNumber) && readString(fp, &relocation.lineContents, objectBytes);
+            valid = valid && wordIndex < wordCount;
+
+            relocation.wordIndex = wordIndex;
+            relocation.instructionOffset = wordIndex * 4;
+            relocation.lineNumber = lineNumber;
+
+            pOutObject->relocations.push_back(std::move(relocation));
+        }
+
+        fclose(fp);
+
+        if (!valid)
+        {
+            pCtx->error(format("Object file '{0}' is truncated or damaged.\n", pPath));
+            return;
+        }
+
+        pCtx->success();
+    }
+
+    // objects are laid out back to back in the given order, their symbols go into the labels of pCtx and every
+    // relocation is patched like a fixup. on failure pOutFailedRelocation is the relocation that could not be resolved
+    bool linkObjects(Cpu::SparkAssemblerContext* pCtx, const vector<SparkObjectFile>& pObjects, const vector<string>& pPaths, vector<Reg>* pOutWords, Cpu::SparkAssemblerFixup* pOutFailedRelocation)
+    {
+        vector<size_t> baseWords(pObjects.size());
+        size_t totalWords = 0;
+
+        for (size_t i = 0; i < pObjects.size(); i++)
+        {
+            baseWords[i] = totalWords;
+            totalWords += pObjects[i].words.size();
+        }
+
+        for (size_t i = 0; i < pObjects.size(); i++)
+        {
+            for (const Cpu::SparkAssemblerLabel& symbol : pObjects[i].symbols)
+            {
+                if (!pCtx->addLabel(static_cast<Reg>(baseWords[i] * 4) + symbol.offset, symbol.name))
+                {
+                    pCtx->error(format("Symbol '{0}' of '{1}' is already defined by another object.\n", symbol.name, pPaths[i]));
+                    return false;
+                }
+            }
+        }
+
+        pOutWords->resize(totalWords);
+
+        for (size_t i = 0; i < pObjects.size(); i++)
+        {
+            copy(pObjects[i].words.begin(), pObjects[i].words.end(), pOutWords->begin() + baseWords[i]);
+        }
+
+        for (size_t i = 0; i < pObjects.size(); i++)
+        {
+            for (Cpu::SparkAssemblerFixup relocation : pObjects[i].relocations)
+            {
+                relocation.wordIndex += baseWords[i];
+                relocation.instructionOffset += static_cast<Reg>(baseWords[i] * 4);
+
+                patchFixup(pCtx, relocation, pOutWords->data());
+
+                if (pCtx->isError())
+                {
+                    *pOutFailedRelocation = relocation;
+                    return false;
+                }
+            }
+        }
+
+        pCtx->success();
+        return true;
+    }
+}
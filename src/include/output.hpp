@@ -0,0 +1,221 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "platform.hpp"
+#include "types.hpp"
+#include "endian.hpp"
+
+namespace SPARK
+{
+    // images at least this large are swapped straight into a mapping of the output instead of a buffer that is then written
+    constexpr size_t SPARK_OUTPUT_MAP_THRESHOLD = 1 << 20;
+
+    // waits until the written data reached the disk, not just the cache of the operating system
+#ifdef _WIN32
+    bool syncToDisk(HANDLE pFile)
+    {
+        return FlushFileBuffers(pFile);
+    }
+#else
+    bool syncToDisk(int pFd)
+    {
+        return fsync(pFd) == 0;
+    }
+#endif
+
+    bool syncToDisk(FILE* pFile)
+    {
+        if (fflush(pFile) != 0)
+        {
+            return false;
+        }
+
+#ifdef _WIN32
+        return syncToDisk(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(pFile))));
+#else
+        return syncToDisk(fileno(pFile));
+#endif
+    }
+
+    // a file that only shows up under its final name once it is complete. it is written under a temporary name next to the
+    // final path and renamed over it by commit, a crash or an error leaves whatever was at the final path before untouched
+    typedef class SparkOutputFile
+    {
+        string path;
+        string temporaryPath;
+        bool committed = false;
+
+    public:
+        // per thread, jobs of one batch and requests of one server may write the same path at the same time
+        explicit SparkOutputFile(const string& pPath)
+        {
+            path = pPath;
+            temporaryPath = format("{0}.{1:x}.tmp", pPath, hash<thread::id>{}(this_thread::get_id()));
+        }
+
+        ~SparkOutputFile()
+        {
+            if (!committed)
+            {
+                error_code error;
+                filesystem::remove(temporaryPath, error);
+            }
+        }
+
+        SparkOutputFile(const SparkOutputFile&) = delete;
+        SparkOutputFile& operator=(const SparkOutputFile&) = delete;
+
+        // where the contents go until commit
+        const string& writePath() const
+        {
+            return temporaryPath;
+        }
+
+        // closes a stream opened on writePath once its contents are on disk. a rename that makes the file visible before its
+        // data is on disk leaves an empty or torn file under the final name if the machine goes down
+        bool close(FILE* pFile)
+        {
+            bool synced = syncToDisk(pFile);
+            return fclose(pFile) == 0 && synced;
+        }
+
+        // the temporary file has to be closed, through close for a stream or after syncToDisk otherwise
+        bool commit()
+        {
+            error_code error;
+            filesystem::rename(temporaryPath, path, error);
+
+            committed = !error;
+            return committed;
+        }
+    } SparkOutputFile;
+
+    // sized to the image up front and filled with one write, or through a mapping for large images that have to be swapped
+    bool writeImageFile(const string& pPath, span<const Reg> pWords, ESparkEndianness pEndianness, string* pOutError)
+    {
+        SparkOutputFile output(pPath);
+
+        size_t size = pWords.size_bytes();
+        bool swap = needsByteswap(pEndianness);
+        bool mapped = swap && size >= SPARK_OUTPUT_MAP_THRESHOLD;
+
+        vector<Reg> swapped;
+        const void* data = pWords.data();
+
+        if (swap && !mapped)
+        {
+            swapped.resize(pWords.size());
+            byteswapWords(pWords.data(), swapped.data(), pWords.size());
+            data = swapped.data();
+        }
+
+        bool written = true;
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(output.writePath().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            *pOutError = format("Error opening file '{0}'.\n", pPath);
+            return false;
+        }
+
+        if (mapped)
+        {
+            LARGE_INTEGER fileSize;
+            fileSize.QuadPart = static_cast<LONGLONG>(size);
+
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, nullptr);
+            void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+
+            written = view != nullptr;
+            if (written)
+            {
+                byteswapWords(pWords.data(), static_cast<Reg*>(view), pWords.size());
+                written = FlushViewOfFile(view, 0) && UnmapViewOfFile(view);
+            }
+
+            if (mapping)
+            {
+                CloseHandle(mapping);
+            }
+        }
+        else
+        {
+            const char* cursor = static_cast<const char*>(data);
+
+            for (size_t remaining = size; written && remaining > 0;)
+            {
+                DWORD chunk = static_cast<DWORD>(min<size_t>(remaining, 1u << 30));
+                DWORD chunkWritten = 0;
+
+                written = WriteFile(file, cursor, chunk, &chunkWritten, nullptr) && chunkWritten > 0;
+                cursor += chunkWritten;
+                remaining -= chunkWritten;
+            }
+        }
+
+        written = written && syncToDisk(file);
+        written = CloseHandle(file) && written;
+#else
+        int fd = ::open(output.writePath().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+        {
+            *pOutError = format("Error opening file '{0}'.\n", pPath);
+            return false;
+        }
+
+        if (mapped)
+        {
+            written = ftruncate(fd, static_cast<off_t>(size)) == 0;
+
+            void* view = written ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            written = view != MAP_FAILED;
+
+            if (written)
+            {
+                byteswapWords(pWords.data(), static_cast<Reg*>(view), pWords.size());
+                written = munmap(view, size) == 0;
+            }
+        }
+        else
+        {
+            const char* cursor = static_cast<const char*>(data);
+
+            for (size_t remaining = size; written && remaining > 0;)
+            {
+                ssize_t chunkWritten = ::write(fd, cursor, remaining);
+
+                written = chunkWritten > 0;
+                cursor += written ? chunkWritten : 0;
+                remaining -= written ? static_cast<size_t>(chunkWritten) : 0;
+            }
+        }
+
+        written = written && syncToDisk(fd);
+        written = ::close(fd) == 0 && written;
+#endif
+
+        if (!written)
+        {
+            *pOutError = format("Error writing file '{0}'.\n", pPath);
+            return false;
+        }
+
+        if (!output.commit())
+        {
+            *pOutError = format("Error replacing file '{0}'.\n", pPath);
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <array>
+#include <bit>
+#include <string_view>
+
+#include "types.hpp"
+
+namespace SPARK
+{
+    template <class V>
+    struct SparkPerfectHashEntry
+    {
+        string_view key;
+        V value;
+    };
+
+    constexpr uint32_t perfectHashString(string_view pKey, uint32_t pSeed)
+    {
+        uint32_t hash = pSeed ^ static_cast<uint32_t>(pKey.size());
+        for (char c : pKey)
+        {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x01000193u;
+        }
+        return hash ^ hash >> 15;
+    }
+
+    // the seed is searched for at compile time so that every key lands in its own slot, a lookup is one hash and one compare
+    template <class V, size_t N>
+    class SparkPerfectHashTable
+    {
+        static constexpr size_t TABLE_SIZE = bit_ceil(N * 4);
+        static constexpr uint32_t MAX_SEED = 1 << 16;
+
+        uint32_t seed = 0;
+        V missing;
+        array<SparkPerfectHashEntry<V>, TABLE_SIZE> slots{};
+
+        static constexpr bool seedIsPerfect(const array<SparkPerfectHashEntry<V>, N>& pEntries, uint32_t pSeed)
+        {
+            array<bool, TABLE_SIZE> used{};
+
+            for (const SparkPerfectHashEntry<V>& entry : pEntries)
+            {
+                size_t slotIdx = perfectHashString(entry.key, pSeed) & (TABLE_SIZE - 1);
+                if (used[slotIdx])
+                {
+                    return false;
+                }
+                used[slotIdx] = true;
+            }
+
+            return true;
+        }
+
+    public:
+        consteval SparkPerfectHashTable(const array<SparkPerfectHashEntry<V>, N>& pEntries, V pMissing)
+        {
+            missing = pMissing;
+
+            seed = 1;
+            while (!seedIsPerfect(pEntries, seed))
+            {
+                // duplicate keys never separate, fail the build instead of searching forever
+                if (++seed == MAX_SEED)
+                {
+                    throw "No perfect hash seed found, are there duplicate keys?";
+                }
+            }
+
+            for (SparkPerfectHashEntry<V>& slot : slots)
+            {
+                slot = {"", pMissing};
+            }
+
+            for (const SparkPerfectHashEntry<V>& entry : pEntries)
+            {
+                slots[perfectHashString(entry.key, seed) & (TABLE_SIZE - 1)] = entry;
+            }
+        }
+
+        constexpr V find(string_view pKey) const
+        {
+            const SparkPerfectHashEntry<V>& slot = slots[perfectHashString(pKey, seed) & (TABLE_SIZE - 1)];
+            return slot.key == pKey ? slot.value : missing;
+        }
+    };
+
+    template <class V, size_t N>
+    constexpr array<SparkPerfectHashEntry<V>, N> enumerateHashEntries(const array<string_view, N>& pKeys)
+    {
+        array<SparkPerfectHashEntry<V>, N> entries{};
+
+        for (size_t i = 0; i < N; i++)
+        {
+            entries[i] = {pKeys[i], static_cast<V>(i)};
+        }
+
+        return entries;
+    }
+}
@@ -0,0 +1,482 @@
+﻿#pragma once
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "platform.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "types.hpp"
+#include "binaryFile.hpp"
+#include "cache.hpp"
+#include "cpu.hpp"
+#include "disassembler.hpp"
+#include "emitter.hpp"
+#include "log.hpp"
+#include "object.hpp"
+#include "source.hpp"
+#include "threadPool.hpp"
+#include "unit.hpp"
+
+namespace SPARK::Server
+{
+#ifdef _WIN32
+    typedef SOCKET SparkSocket;
+    const SparkSocket SPARK_INVALID_SOCKET = INVALID_SOCKET;
+#else
+    typedef int SparkSocket;
+    constexpr SparkSocket SPARK_INVALID_SOCKET = -1;
+#endif
+
+#ifdef MSG_NOSIGNAL
+    // a client that hangs up must not take the server down with SIGPIPE
+    constexpr int SPARK_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    constexpr int SPARK_SEND_FLAGS = 0;
+#endif
+
+    // every message is a 32 bit length followed by the payload, anything larger is a broken peer
+    constexpr uint32_t SPARK_MAX_FRAME_SIZE = 1u << 30;
+
+    // first value of a request payload. every response starts with the exit code and the log output
+    enum ESparkRequestKind : uint32_t
+    {
+        INVREQUEST = 0,
+        // working directory, argument count, arguments -> nothing more, the output is what the command line printed
+        REQUEST_RUN,
+        // working directory, name, source -> diagnostics, words in host byte order, symbols
+        REQUEST_ASSEMBLE,
+        // hexdump flag, word count, words in host byte order -> index of the failed word, the output is the listing
+        REQUEST_DISASSEMBLE
+    };
+
+    // what stays warm between requests, shared by every connection
+    typedef struct SparkServerState
+    {
+        SparkThreadPool* pool;
+        Assembler::Source::SparkSourceManager* sources;
+        Assembler::Cache::SparkMemoryCache* memoryCache;
+
+        // runs a forwarded command line and returns its exit code, everything it logs on the calling thread goes to the client
+        function<int(SparkServerState* pState, const vector<string>& pArguments, const filesystem::path& pWorkingDirectory)> runCommandLine;
+    } SparkServerState;
+
+    bool startSockets()
+    {
+#ifdef _WIN32
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+        return true;
+#endif
+    }
+
+    void closeSocket(SparkSocket pSocket)
+    {
+#ifdef _WIN32
+        closesocket(pSocket);
+#else
+        close(pSocket);
+#endif
+    }
+
+    bool sendAll(SparkSocket pSocket, const char* pData, size_t pLength)
+    {
+        while (pLength > 0)
+        {
+            auto sent = send(pSocket, pData, static_cast<int>(min<size_t>(pLength, INT_MAX)), SPARK_SEND_FLAGS);
+            if (sent <= 0)
+            {
+                return false;
+            }
+
+            pData += sent;
+            pLength -= static_cast<size_t>(sent);
+        }
+
+        return true;
+    }
+
+    // false on error and when the peer closed the connection before pLength bytes arrived
+    bool receiveAll(SparkSocket pSocket, char* pData, size_t pLength)
+    {
+        while (pLength > 0)
+        {
+            auto received = recv(pSocket, pData, static_cast<int>(min<size_t>(pLength, INT_MAX)), 0);
+            if (received <= 0)
+            {
+                return false;
+            }
+
+            pData += received;
+            pLength -= static_cast<size_t>(received);
+        }
+
+        return true;
+    }
+
+    bool sendFrame(SparkSocket pSocket, string_view pPayload)
+    {
+        uint32_t length = static_cast<uint32_t>(pPayload.size());
+        return sendAll(pSocket, reinterpret_cast<const char*>(&length), sizeof(length)) && sendAll(pSocket, pPayload.data(), pPayload.size());
+    }
+
+    bool receiveFrame(SparkSocket pSocket, string* pOutPayload)
+    {
+        uint32_t length = 0;
+        if (!receiveAll(pSocket, reinterpret_cast<char*>(&length), sizeof(length)) || length > SPARK_MAX_FRAME_SIZE)
+        {
+            return false;
+        }
+
+        pOutPayload->resize(length);
+        return receiveAll(pSocket, pOutPayload->data(), length);
+    }
+
+    bool socketAddress(const string& pPath, sockaddr_un* pOutAddress)
+    {
+        memset(pOutAddress, 0, sizeof(*pOutAddress));
+        pOutAddress->sun_family = AF_UNIX;
+
+        if (pPath.empty() || pPath.size() >= sizeof(pOutAddress->sun_path))
+        {
+            return false;
+        }
+
+        memcpy(pOutAddress->sun_path, pPath.data(), pPath.size());
+        return true;
+    }
+
+    SparkSocket connectTo(const string& pPath)
+    {
+        sockaddr_un address;
+        if (!socketAddress(pPath, &address))
+        {
+            return SPARK_INVALID_SOCKET;
+        }
+
+        SparkSocket connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection == SPARK_INVALID_SOCKET)
+        {
+            return SPARK_INVALID_SOCKET;
+        }
+
+        if (connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            closeSocket(connection);
+            return SPARK_INVALID_SOCKET;
+        }
+
+        return connection;
+    }
+
+    SparkSocket listenOn(const string& pPath, string* pOutError)
+    {
+        sockaddr_un address;
+        if (!socketAddress(pPath, &address))
+        {
+            *pOutError = format("Socket path '{0}' is empty or longer than {1} characters.\n", pPath, sizeof(address.sun_path) - 1);
+            return SPARK_INVALID_SOCKET;
+        }
+
+        // a socket file left behind by a server that is gone is replaced, a live server is left alone
+        SparkSocket existing = connectTo(pPath);
+        if (existing != SPARK_INVALID_SOCKET)
+        {
+            closeSocket(existing);
+            *pOutError = format("A server is already listening on '{0}'.\n", pPath);
+            return SPARK_INVALID_SOCKET;
+        }
+
+        error_code error;
+        filesystem::remove(pPath, error);
+
+        SparkSocket listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == SPARK_INVALID_SOCKET)
+        {
+            *pOutError = "Could not create the server socket.\n";
+            return SPARK_INVALID_SOCKET;
+        }
+
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+        {
+            closeSocket(listener);
+            *pOutError = format("Could not listen on '{0}'.\n", pPath);
+            return SPARK_INVALID_SOCKET;
+        }
+
+        return listener;
+    }
+
+    void handleRun(SparkServerState* pState, SparkByteReader* pRequest, string* pOutResponse)
+    {
+        string workingDirectory;
+        uint32_t argumentCount = 0;
+        vector<string> arguments;
+
+        bool valid = pRequest->readString(&workingDirectory) && pRequest->readValue(&argumentCount);
+        for (uint32_t i = 0; valid && i < argumentCount; i++)
+        {
+            valid = pRequest->readString(&arguments.emplace_back());
+        }
+
+        if (!valid)
+        {
+            appendValue(pOutResponse, int32_t(-1));
+            appendString(pOutResponse, "Malformed run request.\n");
+            return;
+        }
+
+        string output;
+
+        tLogCapture = &output;
+        int32_t exitCode = pState->runCommandLine(pState, arguments, filesystem::path(workingDirectory));
+        tLogCapture = nullptr;
+
+        appendValue(pOutResponse, exitCode);
+        appendString(pOutResponse, output);
+    }
+
+    void handleAssemble(SparkServerState* pState, SparkByteReader* pRequest, string* pOutResponse)
+    {
+        string workingDirectory, name, source;
+
+        if (!pRequest->readString(&workingDirectory) || !pRequest->readString(&name) || !pRequest->readString(&source))
+        {
+            appendValue(pOutResponse, int32_t(-1));
+            appendString(pOutResponse, "Malformed assemble request.\n");
+            return;
+        }
+
+        // the buffer only lives for this request and is freed with the unit, its includes come from disk and stay loaded while
+        // they are unchanged
+        uint32_t rootFileId = pState->sources->addMemoryFile(name, source);
+
+        bool assembledUnit;
+        vector<Assembler::SparkDiagnostic> diagnostics;
+        Assembler::Object::SparkObjectFile assembled;
+
+        {
+            Assembler::SparkAssemblyUnit unit(pState->sources, rootFileId);
+            unit.ctx.workingDirectory = workingDirectory;
+
+            assembledUnit = unit.expand(true);
+
+            if (assembledUnit)
+            {
+                uint64_t cacheKey = Assembler::Cache::computeProgramKey(pState->sources, unit.program);
+
+                Assembler::Cache::SparkCachedAssembly cached;
+                if (pState->memoryCache->find(cacheKey, &cached))
+                {
+                    assembled.words = std::move(cached.words);
+                    assembled.symbols = std::move(cached.labels);
+                }
+                else if ((assembledUnit = unit.assemble(pState->pool, false, &assembled)))
+                {
+                    pState->memoryCache->store(cacheKey, {assembled.words, assembled.symbols});
+                }
+            }
+
+            diagnostics = std::move(unit.diagnostics);
+        }
+
+        appendValue(pOutResponse, int32_t(assembledUnit ? 0 : -1));
+        appendString(pOutResponse, "");
+
+        appendValue(pOutResponse, static_cast<uint32_t>(diagnostics.size()));
+        for (const auto& diagnostic : diagnostics)
+        {
+            appendString(pOutResponse, diagnostic.file);
+            appendValue(pOutResponse, static_cast<uint64_t>(diagnostic.lineNumber));
+            appendString(pOutResponse, diagnostic.lineContents);
+            appendString(pOutResponse, diagnostic.reason);
+            appendValue(pOutResponse, uint8_t(diagnostic.severity == Assembler::DIAGNOSTIC_WARNING));
+        }
+
+        if (!assembledUnit)
+        {
+            assembled = {};
+        }
+
+        appendValue(pOutResponse, static_cast<uint32_t>(assembled.words.size()));
+        pOutResponse->append(reinterpret_cast<const char*>(assembled.words.data()), assembled.words.size() * sizeof(Reg));
+
+        appendValue(pOutResponse, static_cast<uint32_t>(assembled.symbols.size()));
+        for (const auto& symbol : assembled.symbols)
+        {
+            appendString(pOutResponse, symbol.name);
+            appendValue(pOutResponse, symbol.offset);
+        }
+    }
+
+    void handleDisassemble(SparkByteReader* pRequest, string* pOutResponse)
+    {
+        uint8_t hexdump = 0;
+        uint32_t wordCount = 0;
+
+        bool valid = pRequest->readValue(&hexdump) && pRequest->readValue(&wordCount) && pRequest->data.size() - pRequest->offset == size_t(wordCount) * sizeof(Reg);
+
+        if (!valid)
+        {
+            appendValue(pOutResponse, int32_t(-1));
+            appendString(pOutResponse, "Malformed disassemble request.\n");
+            return;
+        }
+
+        vector<Reg> words(wordCount);
+        memcpy(words.data(), pRequest->data.data() + pRequest->offset, words.size() * sizeof(Reg));
+
+        Cpu::SparkAssemblerContext ctx;
+        string listing;
+        size_t failedIndex = 0;
+        bool disassembled;
+
+        {
+            SparkTextEmitter emitter(&listing);
+            disassembled = Assembler::Disassembly::disassembleWords(&ctx, words, &emitter, hexdump != 0, &failedIndex);
+        }
+
+        appendValue(pOutResponse, int32_t(disassembled ? 0 : -1));
+        appendString(pOutResponse, disassembled ? listing : ctx.getReason());
+        appendValue(pOutResponse, static_cast<uint64_t>(failedIndex));
+    }
+
+    // requests on one connection are answered in order until the client hangs up
+    void serveConnection(SparkServerState* pState, SparkSocket pConnection)
+    {
+        string request;
+
+        while (receiveFrame(pConnection, &request))
+        {
+            SparkByteReader reader{request};
+            uint32_t kind = INVREQUEST;
+            reader.readValue(&kind);
+
+            // a file changed between two requests is read again
+            pState->sources->refreshStatus();
+
+            string response;
+
+            switch (kind)
+            {
+            case REQUEST_RUN:
+                handleRun(pState, &reader, &response);
+                break;
+            case REQUEST_ASSEMBLE:
+                handleAssemble(pState, &reader, &response);
+                break;
+            case REQUEST_DISASSEMBLE:
+                handleDisassemble(&reader, &response);
+                break;
+            default:
+                appendValue(&response, int32_t(-1));
+                appendString(&response, format("Unknown request kind {0}.\n", kind));
+                break;
+            }
+
+            if (!sendFrame(pConnection, response))
+            {
+                break;
+            }
+        }
+
+        closeSocket(pConnection);
+    }
+
+    // runs until the process is stopped, every connection gets its own thread and all of them share pState
+    bool serve(const string& pSocketPath, SparkServerState* pState)
+    {
+        if (!startSockets())
+        {
+            LOGERR("Could not initialize sockets.\n");
+            return false;
+        }
+
+        string error;
+        SparkSocket listener = listenOn(pSocketPath, &error);
+
+        if (listener == SPARK_INVALID_SOCKET)
+        {
+            LOGERR("{0}", error);
+            return false;
+        }
+
+        LOGINF("Serving on '{0}'.\n", pSocketPath);
+        fflush(stdout);
+
+        while (true)
+        {
+            SparkSocket connection = accept(listener, nullptr, nullptr);
+            if (connection == SPARK_INVALID_SOCKET)
+            {
+                continue;
+            }
+
+            thread(serveConnection, pState, connection).detach();
+        }
+    }
+
+    // forwards a command line to the server at pSocketPath and prints what it printed, returns its exit code
+    int runClient(const string& pSocketPath, const vector<string>& pArguments)
+    {
+        if (!startSockets())
+        {
+            LOGERR("Could not initialize sockets.\n");
+            return -1;
+        }
+
+        SparkSocket connection = connectTo(pSocketPath);
+        if (connection == SPARK_INVALID_SOCKET)
+        {
+            LOGERR("Could not connect to a server on '{0}'.\n", pSocketPath);
+            return -1;
+        }
+
+        error_code error;
+        string request;
+
+        appendValue(&request, uint32_t(REQUEST_RUN));
+        appendString(&request, filesystem::current_path(error).string());
+        appendValue(&request, static_cast<uint32_t>(pArguments.size()));
+
+        for (const string& argument : pArguments)
+        {
+            appendString(&request, argument);
+        }
+
+        string response;
+        bool answered = sendFrame(connection, request) && receiveFrame(connection, &response);
+
+        closeSocket(connection);
+
+        SparkByteReader reader{response};
+        int32_t exitCode = -1;
+        string output;
+
+        if (!answered || !reader.readValue(&exitCode) || !reader.readString(&output))
+        {
+            LOGERR("The server on '{0}' did not answer.\n", pSocketPath);
+            return -1;
+        }
+
+        fwrite(output.data(), 1, output.size(), stdout);
+        return exitCode;
+    }
+}
@@ -0,0 +1,629 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "platform.hpp"
+#include "types.hpp"
+#include "lexer.hpp"
+
+namespace SPARK::Assembler::Source
+{
+    // read-only view of a whole source file, mapped when the platform allows it and read into memory otherwise
+    typedef class SparkMappedFile
+    {
+        const char* mappedData = nullptr;
+        size_t mappedSize = 0;
+        string buffer;
+        string_view borrowed;
+
+#ifdef _WIN32
+        HANDLE fileHandle = INVALID_HANDLE_VALUE;
+        HANDLE mappingHandle = nullptr;
+#endif
+
+        bool map()
+        {
+#ifdef _WIN32
+            fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (fileHandle == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+            {
+                return false;
+            }
+
+            mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mappingHandle)
+            {
+                return false;
+            }
+
+            const void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            if (!view)
+            {
+                return false;
+            }
+
+            mappedData = static_cast<const char*>(view);
+            mappedSize = static_cast<size_t>(fileSize.QuadPart);
+            return true;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+
+            struct stat fileStat{};
+            if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            void* view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+
+            if (view == MAP_FAILED)
+            {
+                return false;
+            }
+
+            madvise(view, fileStat.st_size, MADV_SEQUENTIAL);
+
+            mappedData = static_cast<const char*>(view);
+            mappedSize = fileStat.st_size;
+            return true;
+#endif
+        }
+
+        void unmap()
+        {
+#ifdef _WIN32
+            if (mappedData)
+            {
+                UnmapViewOfFile(mappedData);
+            }
+            if (mappingHandle)
+            {
+                CloseHandle(mappingHandle);
+            }
+            if (fileHandle != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(fileHandle);
+            }
+
+            mappingHandle = nullptr;
+            fileHandle = INVALID_HANDLE_VALUE;
+#else
+            if (mappedData)
+            {
+                munmap(const_cast<char*>(mappedData), mappedSize);
+            }
+#endif
+
+            mappedData = nullptr;
+            mappedSize = 0;
+        }
+
+        bool readBuffered()
+        {
+            std::ifstream file(path, ios::in | ios::binary);
+            if (!file.is_open())
+            {
+                return false;
+            }
+
+            buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            return true;
+        }
+
+    public:
+        string path;
+
+        explicit SparkMappedFile(const string& pPath)
+        {
+            path = pPath;
+        }
+
+        // wraps text owned by the caller, nothing is read from disk and pContents has to outlive the file
+        SparkMappedFile(const string& pPath, string_view pContents)
+        {
+            path = pPath;
+            borrowed = pContents;
+        }
+
+        ~SparkMappedFile()
+        {
+            unmap();
+        }
+
+        SparkMappedFile(const SparkMappedFile&) = delete;
+        SparkMappedFile& operator=(const SparkMappedFile&) = delete;
+
+        bool open()
+        {
+            if (map())
+            {
+                return true;
+            }
+
+            unmap();
+            return readBuffered();
+        }
+
+        bool isMapped() const
+        {
+            return mappedData != nullptr;
+        }
+
+        string_view contents() const
+        {
+            if (mappedData)
+            {
+                return {mappedData, mappedSize};
+            }
+
+            if (borrowed.data())
+            {
+                return borrowed;
+            }
+
+            return buffer;
+        }
+    } SparkMappedFile;
+
+    // a line is only a span into the file it came from, the text is never copied
+    typedef struct SparkSourceLine
+    {
+        uint32_t fileId;
+        uint32_t length;
+        size_t offset;
+        uint32_t lineIndex;
+    } SparkSourceLine;
+
+    constexpr uint32_t SPARK_INVALID_FILE_ID = UINT32_MAX;
+
+    // a run of consecutive lines of one file
+    typedef struct SparkSourceSegment
+    {
+        uint32_t fileId;
+        uint32_t firstLine;
+        uint32_t lineCount;
+    } SparkSourceSegment;
+
+    // the program after include expansion, splicing an include only appends segments and no line is copied
+    typedef class SparkSegmentList
+    {
+    public:
+        vector<SparkSourceSegment> segments;
+        size_t lineCount = 0;
+
+        // files spliced in so far, kept per program so that one source manager can serve several assemblies
+        set<uint32_t> includedFiles;
+
+        // files whose expansion is in progress, the root first and the innermost include last
+        vector<uint32_t> expandingFiles;
+
+        // returns false if the file was included before
+        bool markIncluded(uint32_t pFileId)
+        {
+            return includedFiles.insert(pFileId).second;
+        }
+
+        // returns false if the file is already being expanded further up, including it again would never end
+        bool beginExpansion(uint32_t pFileId)
+        {
+            if (find(expandingFiles.begin(), expandingFiles.end(), pFileId) != expandingFiles.end())
+            {
+                return false;
+            }
+
+            expandingFiles.push_back(pFileId);
+            return true;
+        }
+
+        void endExpansion()
+        {
+            expandingFiles.pop_back();
+        }
+
+        // lines that continue the last segment extend it
+        void append(uint32_t pFileId, uint32_t pFirstLine, uint32_t pLineCount)
+        {
+            if (pLineCount == 0)
+            {
+                return;
+            }
+
+            lineCount += pLineCount;
+
+            if (!segments.empty())
+            {
+                SparkSourceSegment& last = segments.back();
+                if (last.fileId == pFileId && last.firstLine + last.lineCount == pFirstLine)
+                {
+                    last.lineCount += pLineCount;
+                    return;
+                }
+            }
+
+            segments.push_back({pFileId, pFirstLine, pLineCount});
+        }
+    } SparkSegmentList;
+
+    typedef struct SparkFileStatus
+    {
+        bool exists = false;
+        string canonicalPath;
+        uintmax_t size = 0;
+        int64_t modifiedTime = 0;
+    } SparkFileStatus;
+
+    // a loaded file, the token stream is only kept for files that get included. lines and tokens are filled once by
+    // whichever thread asks first and are read-only afterwards
+    typedef struct SparkSourceFile
+    {
+        SparkMappedFile mapping;
+        SparkFileStatus status;
+        once_flag splitOnce;
+        once_flag tokensOnce;
+        atomic<bool> tokensCached = false;
+        bool pragmaOnce = false;
+        vector<SparkSourceLine> lines;
+        vector<Lexer::SparkLineTokens> tokens;
+
+        // guarded by the lock of the manager. a file that is no longer current, because it changed on disk or only ever lived in
+        // memory, is freed once its last user releases it
+        size_t users = 0;
+        bool current = true;
+
+        explicit SparkSourceFile(const string& pPath) : mapping(pPath)
+        {
+        }
+
+        SparkSourceFile(const string& pName, string_view pContents) : mapping(pName, pContents)
+        {
+        }
+    } SparkSourceFile;
+
+    // block k holds 2^(k + SPARK_SOURCE_FIRST_BLOCK_BITS) files, a small manager only allocates the first one
+    constexpr size_t SPARK_SOURCE_FIRST_BLOCK_BITS = 6;
+    constexpr size_t SPARK_SOURCE_FILE_BLOCK_COUNT = 25;
+    constexpr size_t SPARK_SOURCE_MAX_FILES = ((size_t(1) << SPARK_SOURCE_FILE_BLOCK_COUNT) - 1) << SPARK_SOURCE_FIRST_BLOCK_BITS;
+
+    // owns every file of one or more assemblies, a file is opened once per canonical path as long as its size and modification
+    // time stay the same. safe to share between threads, loading takes a lock and reading a loaded file does not
+    typedef class SparkSourceManager
+    {
+        // blocks never move once allocated, so a file is found by id while other threads are still loading files
+        array<unique_ptr<SparkSourceFile*[]>, SPARK_SOURCE_FILE_BLOCK_COUNT> fileBlocks;
+        size_t fileCount = 0;
+
+        // ids of freed files, handed out again before the table grows
+        vector<uint32_t> freeFileIds;
+
+        mutex lock;
+        map<string, uint32_t, less<>> fileIds;
+        map<string, SparkFileStatus, less<>> statusCache;
+
+        // include name and the include paths it was searched in -> resolved path
+        map<string, string, less<>> resolvedIncludes;
+
+        static SparkSourceFile*& slot(array<unique_ptr<SparkSourceFile*[]>, SPARK_SOURCE_FILE_BLOCK_COUNT>& pBlocks, size_t pFileId)
+        {
+            size_t biased = pFileId + (size_t(1) << SPARK_SOURCE_FIRST_BLOCK_BITS);
+            size_t blockBits = bit_width(biased) - 1;
+
+            return pBlocks[blockBits - SPARK_SOURCE_FIRST_BLOCK_BITS][biased - (size_t(1) << blockBits)];
+        }
+
+        SparkSourceFile* file(uint32_t pFileId)
+        {
+            return slot(fileBlocks, pFileId);
+        }
+
+        // lock must be held
+        void freeFileLocked(uint32_t pFileId)
+        {
+            SparkSourceFile*& freed = slot(fileBlocks, pFileId);
+            delete freed;
+            freed = nullptr;
+
+            freeFileIds.push_back(pFileId);
+        }
+
+        // takes ownership of pFile, lock must be held
+        uint32_t addFile(SparkSourceFile* pFile)
+        {
+            if (!freeFileIds.empty())
+            {
+                uint32_t reused = freeFileIds.back();
+                freeFileIds.pop_back();
+
+                slot(fileBlocks, reused) = pFile;
+                return reused;
+            }
+
+            if (fileCount == SPARK_SOURCE_MAX_FILES)
+            {
+                delete pFile;
+                return SPARK_INVALID_FILE_ID;
+            }
+
+            size_t blockBits = bit_width(fileCount + (size_t(1) << SPARK_SOURCE_FIRST_BLOCK_BITS)) - 1;
+
+            auto& block = fileBlocks[blockBits - SPARK_SOURCE_FIRST_BLOCK_BITS];
+            if (!block)
+            {
+                block = make_unique<SparkSourceFile*[]>(size_t(1) << blockBits);
+            }
+
+            slot(fileBlocks, fileCount) = pFile;
+            return static_cast<uint32_t>(fileCount++);
+        }
+
+        // lock must be held
+        const SparkFileStatus& statusLocked(const string& pPath)
+        {
+            auto cached = statusCache.find(pPath);
+            if (cached != statusCache.end())
+            {
+                return cached->second;
+            }
+
+            SparkFileStatus result;
+            error_code error;
+
+            filesystem::path canonical = filesystem::canonical(pPath, error);
+            if (!error && filesystem::is_regular_file(canonical, error))
+            {
+                result.exists = true;
+                result.canonicalPath = canonical.generic_string();
+                result.size = filesystem::file_size(canonical, error);
+                result.modifiedTime = filesystem::last_write_time(canonical, error).time_since_epoch().count();
+            }
+
+            return statusCache.emplace(pPath, std::move(result)).first->second;
+        }
+
+    public:
+        SparkSourceManager() = default;
+
+        ~SparkSourceManager()
+        {
+            for (size_t i = 0; i < fileCount; i++)
+            {
+                delete file(static_cast<uint32_t>(i));
+            }
+        }
+
+        SparkSourceManager(const SparkSourceManager&) = delete;
+        SparkSourceManager& operator=(const SparkSourceManager&) = delete;
+
+        // memoized, a path is only looked at on disk the first time it is asked for
+        SparkFileStatus status(const string& pPath)
+        {
+            lock_guard guard(lock);
+            return statusLocked(pPath);
+        }
+
+        // for managers that outlive a single assembly, files are looked at again on their next load
+        void refreshStatus()
+        {
+            lock_guard guard(lock);
+            statusCache.clear();
+            resolvedIncludes.clear();
+        }
+
+        bool findResolvedInclude(string_view pKey, string* pOutPath)
+        {
+            lock_guard guard(lock);
+
+            auto cached = resolvedIncludes.find(pKey);
+            if (cached == resolvedIncludes.end())
+            {
+                return false;
+            }
+
+            *pOutPath = cached->second;
+            return true;
+        }
+
+        void addResolvedInclude(const string& pKey, const string& pPath)
+        {
+            lock_guard guard(lock);
+            resolvedIncludes.emplace(pKey, pPath);
+        }
+
+        // returns SPARK_INVALID_FILE_ID when the file can not be opened. otherwise the caller is a user of the file until it
+        // calls release
+        uint32_t load(const string& pPath)
+        {
+            lock_guard guard(lock);
+
+            const SparkFileStatus& fileStatus = statusLocked(pPath);
+            if (!fileStatus.exists)
+            {
+                return SPARK_INVALID_FILE_ID;
+            }
+
+            auto known = fileIds.find(fileStatus.canonicalPath);
+            if (known != fileIds.end())
+            {
+                SparkSourceFile* loaded = file(known->second);
+                if (loaded->status.size == fileStatus.size && loaded->status.modifiedTime == fileStatus.modifiedTime)
+                {
+                    loaded->users++;
+                    return known->second;
+                }
+
+                // units that still read the old contents keep it until they are done
+                loaded->current = false;
+                if (loaded->users == 0)
+                {
+                    freeFileLocked(known->second);
+                }
+
+                fileIds.erase(known);
+            }
+
+            auto* loadedFile = new SparkSourceFile(pPath);
+
+            if (!loadedFile->mapping.open())
+            {
+                delete loadedFile;
+                return SPARK_INVALID_FILE_ID;
+            }
+
+            loadedFile->status = fileStatus;
+            loadedFile->users = 1;
+
+            uint32_t fileId = addFile(loadedFile);
+            if (fileId != SPARK_INVALID_FILE_ID)
+            {
+                fileIds.insert_or_assign(fileStatus.canonicalPath, fileId);
+            }
+
+            return fileId;
+        }
+
+        // a source that only exists in memory, pName is used in diagnostics. it is never matched by load or an include and is
+        // freed when the caller releases it
+        uint32_t addMemoryFile(const string& pName, string_view pContents)
+        {
+            auto* memoryFile = new SparkSourceFile(pName, pContents);
+
+            memoryFile->status.exists = true;
+            memoryFile->status.size = pContents.size();
+            memoryFile->users = 1;
+            memoryFile->current = false;
+
+            lock_guard guard(lock);
+            return addFile(memoryFile);
+        }
+
+        // ends one use of a file returned by load or addMemoryFile. a file that is not current anymore is freed with its last
+        // user and its id may be handed out again
+        void release(uint32_t pFileId)
+        {
+            lock_guard guard(lock);
+
+            SparkSourceFile* released = file(pFileId);
+            released->users--;
+
+            if (released->users == 0 && !released->current)
+            {
+                freeFileLocked(pFileId);
+            }
+        }
+
+        const string& path(uint32_t pFileId)
+        {
+            return file(pFileId)->mapping.path;
+        }
+
+        string_view contents(uint32_t pFileId)
+        {
+            return file(pFileId)->mapping.contents();
+        }
+
+        string_view lineText(const SparkSourceLine& pLine)
+        {
+            return contents(pLine.fileId).substr(pLine.offset, pLine.length);
+        }
+
+        // split on the first call, a line excludes its '\n' and a trailing '\r'
+        const vector<SparkSourceLine>& lines(uint32_t pFileId)
+        {
+            SparkSourceFile* sourceFile = file(pFileId);
+
+            call_once(sourceFile->splitOnce, [&]
+            {
+                string_view text = sourceFile->mapping.contents();
+                size_t cursor = 0;
+
+                while (cursor < text.size())
+                {
+                    const char* begin = text.data() + cursor;
+                    const auto* newline = static_cast<const char*>(memchr(begin, '\n', text.size() - cursor));
+
+                    size_t length = newline ? newline - begin : text.size() - cursor;
+                    size_t next = cursor + length + 1;
+
+                    if (length > 0 && begin[length - 1] == '\r')
+                    {
+                        length--;
+                    }
+
+                    sourceFile->lines.push_back({pFileId, static_cast<uint32_t>(length), cursor, static_cast<uint32_t>(sourceFile->lines.size())});
+                    cursor = next;
+                }
+            });
+
+            return sourceFile->lines;
+        }
+
+        span<const SparkSourceLine> segmentLines(const SparkSourceSegment& pSegment)
+        {
+            return span<const SparkSourceLine>(lines(pSegment.fileId)).subspan(pSegment.firstLine, pSegment.lineCount);
+        }
+
+        // lexes every line of the file once and keeps the result, later includes of the same file reuse it
+        void cacheTokens(uint32_t pFileId)
+        {
+            SparkSourceFile* sourceFile = file(pFileId);
+            const vector<SparkSourceLine>& fileLines = lines(pFileId);
+
+            call_once(sourceFile->tokensOnce, [&]
+            {
+                sourceFile->tokens.resize(fileLines.size());
+
+                for (size_t i = 0; i < fileLines.size(); i++)
+                {
+                    Lexer::tokenizeAssemblyLine(lineText(fileLines[i]), &sourceFile->tokens[i]);
+                    sourceFile->pragmaOnce |= sourceFile->tokens[i].isPragmaOnce();
+                }
+
+                sourceFile->tokensCached.store(true, memory_order_release);
+            });
+        }
+
+        // lines of a file whose tokens are still being cached by another thread are lexed on the spot
+        void lineTokens(const SparkSourceLine& pLine, Lexer::SparkLineTokens* pOutTokens)
+        {
+            SparkSourceFile* sourceFile = file(pLine.fileId);
+            if (sourceFile->tokensCached.load(memory_order_acquire))
+            {
+                *pOutTokens = sourceFile->tokens[pLine.lineIndex];
+                return;
+            }
+
+            Lexer::tokenizeAssemblyLine(lineText(pLine), pOutTokens);
+        }
+
+        // only meaningful once cacheTokens ran for the file
+        bool isPragmaOnce(uint32_t pFileId)
+        {
+            return file(pFileId)->pragmaOnce;
+        }
+    } SparkSourceManager;
+}
@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// in-process assembler and disassembler. nothing here touches the file system, sources and words come from memory and every
+// output goes into a buffer owned by the caller. calls share no state, so they can run concurrently from any number of threads
+namespace SPARK::Library
+{
+    typedef struct SparkAssembleOptions
+    {
+        // the file name diagnostics refer to
+        std::string name = "<memory>";
+
+        // 0 uses every hardware thread, 1 encodes on the calling thread
+        size_t threadCount = 1;
+    } SparkAssembleOptions;
+
+    typedef struct SparkDiagnostic
+    {
+        std::string file;
+        size_t lineNumber;
+        std::string lineContents;
+        std::string reason;
+        bool warning;
+    } SparkDiagnostic;
+
+    typedef struct SparkSymbol
+    {
+        std::string name;
+        uint32_t offset;
+    } SparkSymbol;
+
+    // can be reused across calls, the vectors keep their capacity
+    typedef struct SparkAssembleResult
+    {
+        bool success = false;
+
+        // words the program needs, set even when the output buffer was too small
+        size_t wordCount = 0;
+
+        std::vector<SparkDiagnostic> diagnostics;
+        std::vector<SparkSymbol> symbols;
+    } SparkAssembleResult;
+
+    typedef struct SparkDisassembleOptions
+    {
+        // appends the raw word and its byte offset to every line
+        bool hexdump = false;
+    } SparkDisassembleOptions;
+
+    typedef struct SparkDisassembleResult
+    {
+        bool success = false;
+
+        // characters the listing needs, set even when the output buffer was too small
+        size_t textLength = 0;
+
+        // index of the word that could not be decoded
+        size_t failedIndex = 0;
+        std::string reason;
+    } SparkDisassembleResult;
+
+    // assembles pSource into pOutWords as instruction values in host byte order. #include is an error and #includePath is ignored.
+    // returns false on an error or when the program does not fit pOutWords, pOutResult->wordCount is then the size to retry with
+    bool assemble(std::string_view pSource, std::span<uint32_t> pOutWords, const SparkAssembleOptions& pOptions, SparkAssembleResult* pOutResult);
+
+    // writes the listing of pWords (host byte order) into pOutText without a terminating zero. returns false on an undecodable word
+    // or when the listing does not fit pOutText, pOutResult->textLength is then the size to retry with
+    bool disassemble(std::span<const uint32_t> pWords, std::span<char> pOutText, const SparkDisassembleOptions& pOptions, SparkDisassembleResult* pOutResult);
+}
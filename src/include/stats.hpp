@@ -0,0 +1,329 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <string>
+#include <string_view>
+
+#include "platform.hpp"
+#include "types.hpp"
+#include "output.hpp"
+#include "trace.hpp"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace SPARK::Stats
+{
+    enum ESparkPhase
+    {
+        PHASE_IDLE = -1,
+        PHASE_INCLUDE,
+        PHASE_LEX,
+        PHASE_CLASSIFY,
+        PHASE_PARSE,
+        PHASE_MACRO,
+        PHASE_ENCODE,
+        PHASE_CACHE,
+        PHASE_LINK,
+        PHASE_READ,
+        PHASE_DECODE,
+        PHASE_FORMAT,
+        PHASE_HEXDUMP,
+        PHASE_WRITE,
+        PHASE_COUNT
+    };
+
+    inline constexpr array<string_view, PHASE_COUNT> gPhaseNames = {
+        "include expansion",
+        "lex",
+        "line classification",
+        "parse",
+        "macro expansion",
+        "encode",
+        "cache",
+        "link",
+        "read",
+        "decode",
+        "format",
+        "hexdump",
+        "write",
+    };
+
+    // counted by the operator new of the executable while at least one run is tracking allocations, process wide
+    inline atomic<uint64_t> gAllocationCount = 0;
+    inline atomic<size_t> gAllocationTracking = 0;
+
+    // totals of one run, shared by every job and worker of it
+    typedef struct SparkStats
+    {
+        array<atomic<uint64_t>, PHASE_COUNT> phaseNanoseconds{};
+
+        atomic<uint64_t> files = 0;
+        atomic<uint64_t> sourceLines = 0;
+        atomic<uint64_t> words = 0;
+        atomic<uint64_t> includeFiles = 0;
+        atomic<uint64_t> includeLookups = 0;
+        atomic<uint64_t> includeCacheHits = 0;
+
+        chrono::steady_clock::time_point started;
+        uint64_t wallNanoseconds = 0;
+        uint64_t allocations = 0;
+        size_t peakResidentBytes = 0;
+    } SparkStats;
+
+    // exact within a thread, time is only added to the shared totals once the clock goes away so workers do not contend on
+    // them line by line. with a trace attached every phase entered through enter is also recorded as a span, nested scopes
+    // are not. with neither attached every call returns right away
+    typedef class SparkPhaseClock
+    {
+        SparkStats* stats = nullptr;
+        Trace::SparkTraceRecorder* trace = nullptr;
+        ESparkPhase phase = PHASE_IDLE;
+        chrono::steady_clock::time_point since;
+        array<uint64_t, PHASE_COUNT> elapsed{};
+
+        ESparkPhase spanPhase = PHASE_IDLE;
+        chrono::steady_clock::time_point spanStart;
+
+        ESparkPhase account(ESparkPhase pPhase, chrono::steady_clock::time_point pNow)
+        {
+            ESparkPhase previous = phase;
+
+            if (previous != PHASE_IDLE)
+            {
+                elapsed[previous] += static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(pNow - since).count());
+            }
+
+            phase = pPhase;
+            since = pNow;
+            return previous;
+        }
+
+    public:
+        SparkPhaseClock() = default;
+
+        ~SparkPhaseClock()
+        {
+            publish();
+        }
+
+        SparkPhaseClock(const SparkPhaseClock&) = delete;
+        SparkPhaseClock& operator=(const SparkPhaseClock&) = delete;
+
+        // both may be null
+        void attach(SparkStats* pStats, Trace::SparkTraceRecorder* pTrace)
+        {
+            publish();
+            stats = pStats;
+            trace = pTrace;
+        }
+
+        bool enabled() const
+        {
+            return stats || trace;
+        }
+
+        // the time since the last switch goes to the phase that was current, which is returned. ends the span of the last
+        // phase entered this way
+        ESparkPhase enter(ESparkPhase pPhase)
+        {
+            if (!enabled())
+            {
+                return PHASE_IDLE;
+            }
+
+            auto now = chrono::steady_clock::now();
+
+            if (trace && pPhase != spanPhase)
+            {
+                if (spanPhase != PHASE_IDLE)
+                {
+                    trace->record(string(gPhaseNames[spanPhase]), "phase", spanStart, now);
+                }
+
+                spanPhase = pPhase;
+                spanStart = now;
+            }
+
+            return account(pPhase, now);
+        }
+
+        // for phases nested in one entered through enter, only the time is split off, the span of the outer phase goes on
+        ESparkPhase enterNested(ESparkPhase pPhase)
+        {
+            if (!enabled())
+            {
+                return PHASE_IDLE;
+            }
+
+            return account(pPhase, chrono::steady_clock::now());
+        }
+
+        // ends the current phase and adds everything measured so far to the totals
+        void publish()
+        {
+            if (!enabled())
+            {
+                return;
+            }
+
+            enter(PHASE_IDLE);
+
+            if (!stats)
+            {
+                return;
+            }
+
+            for (size_t i = 0; i < elapsed.size(); i++)
+            {
+                if (elapsed[i] > 0)
+                {
+                    stats->phaseNanoseconds[i].fetch_add(elapsed[i], memory_order_relaxed);
+                    elapsed[i] = 0;
+                }
+            }
+        }
+    } SparkPhaseClock;
+
+    // switches pClock (may be null) to pPhase and back to whatever was current before once it goes out of scope, a nested phase
+    // that does not get a span of its own
+    typedef class SparkPhaseScope
+    {
+        SparkPhaseClock* clock;
+        ESparkPhase previous = PHASE_IDLE;
+
+    public:
+        SparkPhaseScope(SparkPhaseClock* pClock, ESparkPhase pPhase)
+        {
+            clock = pClock && pClock->enabled() ? pClock : nullptr;
+
+            if (clock)
+            {
+                previous = clock->enterNested(pPhase);
+            }
+        }
+
+        ~SparkPhaseScope()
+        {
+            if (clock)
+            {
+                clock->enterNested(previous);
+            }
+        }
+
+        SparkPhaseScope(const SparkPhaseScope&) = delete;
+        SparkPhaseScope& operator=(const SparkPhaseScope&) = delete;
+    } SparkPhaseScope;
+
+    size_t peakResidentBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters{};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            return 0;
+        }
+
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+
+#ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss);
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    void beginRun(SparkStats* pStats)
+    {
+        gAllocationTracking.fetch_add(1, memory_order_relaxed);
+
+        pStats->allocations = gAllocationCount.load(memory_order_relaxed);
+        pStats->started = chrono::steady_clock::now();
+    }
+
+    // every clock of the run has to be published by now
+    void endRun(SparkStats* pStats)
+    {
+        pStats->wallNanoseconds = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - pStats->started).count());
+        pStats->allocations = gAllocationCount.load(memory_order_relaxed) - pStats->allocations;
+        pStats->peakResidentBytes = peakResidentBytes();
+
+        gAllocationTracking.fetch_sub(1, memory_order_relaxed);
+    }
+
+    double perSecond(uint64_t pCount, uint64_t pNanoseconds)
+    {
+        return pNanoseconds > 0 ? static_cast<double>(pCount) * 1e9 / static_cast<double>(pNanoseconds) : 0.0;
+    }
+
+    double milliseconds(uint64_t pNanoseconds)
+    {
+        return static_cast<double>(pNanoseconds) / 1e6;
+    }
+
+    double includeCacheHitRate(const SparkStats& pStats)
+    {
+        uint64_t lookups = pStats.includeLookups.load();
+        return lookups > 0 ? static_cast<double>(pStats.includeCacheHits.load()) / static_cast<double>(lookups) : 0.0;
+    }
+
+    // one object, phase times in milliseconds. phases that did not run are left out
+    string statsToJson(const SparkStats& pStats)
+    {
+        string json = "{\n  \"phases\": {";
+        bool first = true;
+
+        for (size_t i = 0; i < PHASE_COUNT; i++)
+        {
+            uint64_t nanoseconds = pStats.phaseNanoseconds[i].load();
+            if (nanoseconds == 0)
+            {
+                continue;
+            }
+
+            json += format("{0}\n    \"{1}\": {2:.3f}", first ? "" : ",", gPhaseNames[i], milliseconds(nanoseconds));
+            first = false;
+        }
+
+        json += format("\n  }},\n  \"wallMs\": {0:.3f},\n", milliseconds(pStats.wallNanoseconds));
+        json += format("  \"files\": {0},\n  \"sourceLines\": {1},\n  \"words\": {2},\n", pStats.files.load(), pStats.sourceLines.load(), pStats.words.load());
+        json += format("  \"linesPerSecond\": {0:.0f},\n  \"wordsPerSecond\": {1:.0f},\n", perSecond(pStats.sourceLines, pStats.wallNanoseconds), perSecond(pStats.words, pStats.wallNanoseconds));
+        json += format("  \"includeFiles\": {0},\n  \"includeLookups\": {1},\n  \"includeCacheHits\": {2},\n  \"includeCacheHitRate\": {3:.4f},\n",
+                       pStats.includeFiles.load(), pStats.includeLookups.load(), pStats.includeCacheHits.load(), includeCacheHitRate(pStats));
+        json += format("  \"peakResidentBytes\": {0},\n  \"allocations\": {1}\n}}\n", pStats.peakResidentBytes, pStats.allocations);
+
+        return json;
+    }
+
+    bool writeStatsFile(const string& pPath, const SparkStats& pStats)
+    {
+        SparkOutputFile output(pPath);
+
+        FILE* fp = fopen(output.writePath().c_str(), "wb");
+        if (!fp)
+        {
+            return false;
+        }
+
+        string json = statsToJson(pStats);
+        bool written = fwrite(json.data(), 1, json.size(), fp) == json.size();
+
+        written = output.close(fp) && written;
+
+        return written && output.commit();
+    }
+}
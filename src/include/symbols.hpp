@@ -0,0 +1,167 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "types.hpp"
+#include "SafeList.hpp"
+
+namespace SPARK::Cpu
+{
+    typedef struct SparkAssemblerLabel
+    {
+        Reg offset;
+        string name;
+
+        SparkAssemblerLabel(Reg pOffset, const string& pName)
+        {
+            offset = pOffset;
+            name = pName;
+        }
+    } SparkAssemblerLabel;
+
+    // a label reference that could not be resolved while parsing. inside an assembly it is resolved into operand operandIndex of
+    // the instruction before encoding, a relocation of an object file is patched into the encoded word by the linker
+    typedef struct SparkAssemblerFixup
+    {
+        size_t wordIndex;
+        Reg instructionOffset;
+        Reg fieldShift;
+        Reg fieldMask;
+        // not stored in object files, the linker only works on words
+        size_t operandIndex;
+        string labelName;
+
+        string file;
+        size_t lineNumber;
+        string lineContents;
+    } SparkAssemblerFixup;
+
+    // fnv-1a, labels are short so anything heavier does not pay off
+    constexpr uint64_t hashSymbolName(string_view pName)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (char c : pName)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // open addressing with linear probing, slots index into the insertion ordered label list
+    typedef class SparkSymbolTable
+    {
+        static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+        typedef struct SparkSymbolSlot
+        {
+            uint32_t hash;
+            uint32_t index;
+        } SparkSymbolSlot;
+
+        vector<SparkSymbolSlot> slots;
+        SafeList<SparkAssemblerLabel*> ordered;
+
+        size_t probe(string_view pName, uint32_t pHash)
+        {
+            size_t mask = slots.size() - 1;
+            size_t slotIdx = pHash & mask;
+
+            while (true)
+            {
+                const SparkSymbolSlot& slot = slots[slotIdx];
+                if (slot.index == EMPTY_SLOT)
+                {
+                    return slotIdx;
+                }
+
+                if (slot.hash == pHash && ordered[slot.index]->name == pName)
+                {
+                    return slotIdx;
+                }
+
+                slotIdx = (slotIdx + 1) & mask;
+            }
+        }
+
+        void grow()
+        {
+            vector<SparkSymbolSlot> previous = std::move(slots);
+            slots.assign(previous.empty() ? 64 : previous.size() * 2, {0, EMPTY_SLOT});
+
+            for (const SparkSymbolSlot& slot : previous)
+            {
+                if (slot.index != EMPTY_SLOT)
+                {
+                    slots[probeEmpty(slot.hash)] = slot;
+                }
+            }
+        }
+
+        size_t probeEmpty(uint32_t pHash) const
+        {
+            size_t mask = slots.size() - 1;
+            size_t slotIdx = pHash & mask;
+
+            while (slots[slotIdx].index != EMPTY_SLOT)
+            {
+                slotIdx = (slotIdx + 1) & mask;
+            }
+
+            return slotIdx;
+        }
+
+    public:
+        SparkSymbolTable() = default;
+
+        SparkSymbolTable(const SparkSymbolTable&) = delete;
+        SparkSymbolTable& operator=(const SparkSymbolTable&) = delete;
+
+        // pLabel is owned by the caller and has to outlive the table, returns false and leaves the table untouched when the name is already defined
+        bool add(SparkAssemblerLabel* pLabel)
+        {
+            // keep the load factor at or below 1/2
+            if ((ordered.count() + 1) * 2 > slots.size())
+            {
+                grow();
+            }
+
+            auto hash = static_cast<uint32_t>(hashSymbolName(pLabel->name));
+            size_t slotIdx = probe(pLabel->name, hash);
+
+            if (slots[slotIdx].index != EMPTY_SLOT)
+            {
+                return false;
+            }
+
+            slots[slotIdx] = {hash, static_cast<uint32_t>(ordered.count())};
+            ordered.add(pLabel);
+            return true;
+        }
+
+        SparkAssemblerLabel* find(string_view pName)
+        {
+            if (slots.empty())
+            {
+                return nullptr;
+            }
+
+            size_t slotIdx = probe(pName, static_cast<uint32_t>(hashSymbolName(pName)));
+            uint32_t index = slots[slotIdx].index;
+
+            return index == EMPTY_SLOT ? nullptr : ordered[index];
+        }
+
+        size_t count()
+        {
+            return ordered.count();
+        }
+
+        SparkAssemblerLabel* at(size_t pIdx)
+        {
+            return ordered[pIdx];
+        }
+    } SparkSymbolTable;
+}
@@ -0,0 +1,228 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+
+namespace SPARK
+{
+    // fixed set of workers with one task queue each. a thread takes its own newest task first and steals the oldest task of
+    // another queue when its own is empty. a thread waiting in parallelFor keeps running tasks until its own are done, so a
+    // task may call parallelFor on the same pool, and several threads outside the pool may use it at once
+    typedef class SparkThreadPool
+    {
+        // the tasks of one parallelFor call
+        typedef struct SparkTaskGroup
+        {
+            const function<void(size_t)>* task;
+            atomic<size_t> pending;
+        } SparkTaskGroup;
+
+        typedef struct SparkTask
+        {
+            SparkTaskGroup* group;
+            size_t index;
+        } SparkTask;
+
+        typedef struct SparkWorkQueue
+        {
+            mutex lock;
+            deque<SparkTask> tasks;
+        } SparkWorkQueue;
+
+        vector<thread> workers;
+
+        // one per worker, the last one is shared by the threads outside the pool
+        unique_ptr<SparkWorkQueue[]> queues;
+        size_t queueCount;
+
+        mutex lock;
+        condition_variable wake;
+
+        // only raised while holding lock so a sleeping thread can not miss new work
+        atomic<size_t> queuedTasks = 0;
+        bool stopping = false;
+
+        inline static thread_local SparkThreadPool* tCurrentPool = nullptr;
+        inline static thread_local size_t tCurrentQueue = 0;
+
+        size_t ownQueue() const
+        {
+            return tCurrentPool == this ? tCurrentQueue : queueCount - 1;
+        }
+
+        bool takeTask(SparkTask* pOutTask)
+        {
+            size_t own = ownQueue();
+
+            {
+                SparkWorkQueue& queue = queues[own];
+                lock_guard guard(queue.lock);
+
+                if (!queue.tasks.empty())
+                {
+                    *pOutTask = queue.tasks.back();
+                    queue.tasks.pop_back();
+                    queuedTasks.fetch_sub(1, memory_order_relaxed);
+                    return true;
+                }
+            }
+
+            for (size_t i = 1; i < queueCount; i++)
+            {
+                SparkWorkQueue& victim = queues[(own + i) % queueCount];
+                lock_guard guard(victim.lock);
+
+                if (!victim.tasks.empty())
+                {
+                    *pOutTask = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    queuedTasks.fetch_sub(1, memory_order_relaxed);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void runTask(const SparkTask& pTask)
+        {
+            (*pTask.group->task)(pTask.index);
+
+            // the group lives on the stack of the thread waiting for it, it must not be touched once pending reaches zero
+            if (pTask.group->pending.fetch_sub(1, memory_order_acq_rel) == 1)
+            {
+                {
+                    lock_guard guard(lock);
+                }
+                wake.notify_all();
+            }
+        }
+
+        void workerLoop(size_t pQueueIdx)
+        {
+            tCurrentPool = this;
+            tCurrentQueue = pQueueIdx;
+
+            SparkTask task;
+
+            while (true)
+            {
+                if (takeTask(&task))
+                {
+                    runTask(task);
+                    continue;
+                }
+
+                unique_lock guard(lock);
+                wake.wait(guard, [&] { return stopping || queuedTasks.load(memory_order_relaxed) > 0; });
+
+                if (stopping)
+                {
+                    return;
+                }
+            }
+        }
+
+    public:
+        // pThreadCount includes the calling thread, 0 picks one thread per hardware thread
+        explicit SparkThreadPool(size_t pThreadCount)
+        {
+            if (pThreadCount == 0)
+            {
+                pThreadCount = thread::hardware_concurrency();
+            }
+
+            size_t workerCount = pThreadCount > 1 ? pThreadCount - 1 : 0;
+
+            queueCount = workerCount + 1;
+            queues = make_unique<SparkWorkQueue[]>(queueCount);
+
+            for (size_t i = 0; i < workerCount; i++)
+            {
+                workers.emplace_back([this, i] { workerLoop(i); });
+            }
+        }
+
+        ~SparkThreadPool()
+        {
+            {
+                lock_guard guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+
+            for (thread& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        SparkThreadPool(const SparkThreadPool&) = delete;
+        SparkThreadPool& operator=(const SparkThreadPool&) = delete;
+
+        size_t threadCount() const
+        {
+            return workers.size() + 1;
+        }
+
+        // runs pTask(0) .. pTask(pTaskCount - 1) across the pool and returns once all of them have finished
+        void parallelFor(size_t pTaskCount, const function<void(size_t)>& pTask)
+        {
+            if (pTaskCount == 0)
+            {
+                return;
+            }
+
+            if (workers.empty() || pTaskCount == 1)
+            {
+                for (size_t i = 0; i < pTaskCount; i++)
+                {
+                    pTask(i);
+                }
+                return;
+            }
+
+            SparkTaskGroup group{&pTask, pTaskCount};
+
+            {
+                // pushed in reverse so the owner runs them in order and thieves take them from the far end
+                SparkWorkQueue& queue = queues[ownQueue()];
+                lock_guard guard(queue.lock);
+
+                for (size_t i = pTaskCount; i-- > 0;)
+                {
+                    queue.tasks.push_back({&group, i});
+                }
+            }
+
+            {
+                lock_guard guard(lock);
+                queuedTasks.fetch_add(pTaskCount, memory_order_relaxed);
+            }
+            wake.notify_all();
+
+            SparkTask task;
+
+            while (group.pending.load(memory_order_acquire) > 0)
+            {
+                if (takeTask(&task))
+                {
+                    runTask(task);
+                    continue;
+                }
+
+                // the rest of the group is running on other threads, sleep until it finishes or new work shows up
+                unique_lock guard(lock);
+                wake.wait(guard, [&] { return group.pending.load(memory_order_acquire) == 0 || queuedTasks.load(memory_order_relaxed) > 0; });
+            }
+        }
+    } SparkThreadPool;
+}
@@ -0,0 +1,159 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "output.hpp"
+
+namespace SPARK::Trace
+{
+    typedef struct SparkTraceEvent
+    {
+        string name;
+        string_view category;
+        uint64_t startNanoseconds;
+        uint64_t durationNanoseconds;
+        uint32_t threadIdx;
+    } SparkTraceEvent;
+
+    // spans of one run in the chrome trace event format, any thread may record. only coarse spans are recorded, a phase,
+    // an include file or a chunk of work, never a single line
+    typedef class SparkTraceRecorder
+    {
+        mutex lock;
+        vector<SparkTraceEvent> events;
+        map<thread::id, uint32_t> threads;
+        chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+        uint64_t sinceOrigin(chrono::steady_clock::time_point pTime) const
+        {
+            return pTime > origin ? static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(pTime - origin).count()) : 0;
+        }
+
+    public:
+        SparkTraceRecorder() = default;
+
+        SparkTraceRecorder(const SparkTraceRecorder&) = delete;
+        SparkTraceRecorder& operator=(const SparkTraceRecorder&) = delete;
+
+        void record(string pName, string_view pCategory, chrono::steady_clock::time_point pStart, chrono::steady_clock::time_point pEnd)
+        {
+            uint64_t start = sinceOrigin(pStart);
+            uint64_t end = sinceOrigin(pEnd);
+
+            lock_guard guard(lock);
+
+            // threads are numbered in the order they first record something
+            auto [known, added] = threads.try_emplace(this_thread::get_id(), static_cast<uint32_t>(threads.size()));
+            events.push_back({std::move(pName), pCategory, start, end - start, known->second});
+        }
+
+        // call once every thread of the run is done recording
+        string toJson()
+        {
+            lock_guard guard(lock);
+
+            string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+            for (uint32_t i = 0; i < threads.size(); i++)
+            {
+                json += format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{0},\"args\":{{\"name\":\"thread {0}\"}}}},\n", i);
+            }
+
+            for (size_t i = 0; i < events.size(); i++)
+            {
+                const SparkTraceEvent& event = events[i];
+
+                json += format("{{\"name\":\"{0}\",\"cat\":\"{1}\",\"ph\":\"X\",\"ts\":{2:.3f},\"dur\":{3:.3f},\"pid\":1,\"tid\":{4}}}{5}\n", escapeJson(event.name), event.category,
+                               static_cast<double>(event.startNanoseconds) / 1e3, static_cast<double>(event.durationNanoseconds) / 1e3, event.threadIdx, i + 1 < events.size() ? "," : "");
+            }
+
+            json += "]}\n";
+            return json;
+        }
+
+        static string escapeJson(string_view pText)
+        {
+            string escaped;
+            escaped.reserve(pText.size());
+
+            for (char c : pText)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    escaped += '\\';
+                    escaped += c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    escaped += format("\\u{0:04x}", static_cast<unsigned char>(c));
+                }
+                else
+                {
+                    escaped += c;
+                }
+            }
+
+            return escaped;
+        }
+    } SparkTraceRecorder;
+
+    // records one span from construction to destruction. without a recorder nothing is read, copied or allocated
+    typedef class SparkTraceScope
+    {
+        SparkTraceRecorder* recorder;
+        string_view category;
+        string name;
+        chrono::steady_clock::time_point start;
+
+    public:
+        SparkTraceScope(SparkTraceRecorder* pRecorder, string_view pCategory, string_view pName)
+        {
+            recorder = pRecorder;
+
+            if (recorder)
+            {
+                category = pCategory;
+                name = pName;
+                start = chrono::steady_clock::now();
+            }
+        }
+
+        ~SparkTraceScope()
+        {
+            if (recorder)
+            {
+                recorder->record(std::move(name), category, start, chrono::steady_clock::now());
+            }
+        }
+
+        SparkTraceScope(const SparkTraceScope&) = delete;
+        SparkTraceScope& operator=(const SparkTraceScope&) = delete;
+    } SparkTraceScope;
+
+    bool writeTraceFile(const string& pPath, SparkTraceRecorder* pRecorder)
+    {
+        SparkOutputFile output(pPath);
+
+        FILE* fp = fopen(output.writePath().c_str(), "wb");
+        if (!fp)
+        {
+            return false;
+        }
+
+        string json = pRecorder->toJson();
+        bool written = fwrite(json.data(), 1, json.size(), fp) == json.size();
+
+        written = output.close(fp) && written;
+
+        return written && output.commit();
+    }
+}
@@ -0,0 +1,263 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "types.hpp"
+#include "assembler.hpp"
+#include "cpu.hpp"
+#include "ir.hpp"
+#include "lexer.hpp"
+#include "object.hpp"
+#include "source.hpp"
+#include "threadPool.hpp"
+
+namespace SPARK::Assembler
+{
+    // one root file taken from source to words, symbols and relocations. the unit owns its context, so units on different
+    // threads share nothing but the constexpr isa tables
+    typedef class SparkAssemblyUnit
+    {
+        // records the failing line of the context and returns false
+        bool fail()
+        {
+            diagnostics.push_back({ctx.currentFile.string(), ctx.currentLine.assemblerLineNumber, string(ctx.currentLine.rawLineContents), ctx.getReason()});
+            return false;
+        }
+
+    public:
+        Cpu::SparkAssemblerContext ctx;
+        Source::SparkSourceManager* sources;
+        uint32_t rootFileId;
+
+        // the root file with every include spliced in, filled by expand
+        Source::SparkSegmentList program;
+
+        // warnings in source order, a failed step adds its error last
+        vector<SparkDiagnostic> diagnostics;
+
+        // takes over the use of pRootFileId the caller got from load or addMemoryFile
+        SparkAssemblyUnit(Source::SparkSourceManager* pSources, uint32_t pRootFileId) : ctx(pSources->path(pRootFileId))
+        {
+            sources = pSources;
+            rootFileId = pRootFileId;
+        }
+
+        ~SparkAssemblyUnit()
+        {
+            for (uint32_t fileId : program.includedFiles)
+            {
+                sources->release(fileId);
+            }
+
+            sources->release(rootFileId);
+        }
+
+        SparkAssemblyUnit(const SparkAssemblyUnit&) = delete;
+        SparkAssemblyUnit& operator=(const SparkAssemblyUnit&) = delete;
+
+        // resolves the include directives of the root file. without pAllowIncludes nothing is read from disk, an #include is an
+        // error and an #includePath is skipped
+        bool expand(bool pAllowIncludes)
+        {
+            Cpu::AssemblyLine& line = ctx.currentLine;
+            ctx.phases.enter(Stats::PHASE_INCLUDE);
+
+            // an include of the root file from anywhere below it is recursive as well
+            program.beginExpansion(rootFileId);
+
+            for (const auto& rootLine : sources->lines(rootFileId))
+            {
+                line.assemblerLineNumber = rootLine.lineIndex + 1;
+                line.rawLineContents = sources->lineText(rootLine);
+
+                // only directives matter here, every other line is lexed by the symbol pass
+                if (!Lexer::startsWithDirective(line.rawLineContents))
+                {
+                    program.append(rootFileId, rootLine.lineIndex, 1);
+                    continue;
+                }
+
+                sources->lineTokens(rootLine, &line.tokens);
+
+                if (Analysis::currentAssemblyLineHasPragmaOnce(&ctx))
+                {
+                    continue;
+                }
+
+                if (Analysis::currentAssemblyLineHasIncludePath(&ctx))
+                {
+                    // nothing can be included, so the path is never looked at
+                    if (!pAllowIncludes)
+                    {
+                        continue;
+                    }
+
+                    ctx.addIncludePath(Analysis::getIncludePathName(line.tokens));
+                    if (ctx.isError())
+                    {
+                        return fail();
+                    }
+
+                    continue;
+                }
+
+                if (Analysis::currentAssemblyLineHasInclude(&ctx))
+                {
+                    if (!pAllowIncludes)
+                    {
+                        ctx.error("Includes are disabled, the program has to be a single source.\n");
+                        return fail();
+                    }
+
+                    Analysis::expandCurrentIncludeRecursively(&ctx, sources, &program);
+
+                    // the context points at the include directive that failed
+                    if (ctx.isError())
+                    {
+                        return fail();
+                    }
+
+                    ctx.setCurrentFile(sources->path(rootFileId));
+                    continue;
+                }
+
+                program.append(rootFileId, rootLine.lineIndex, 1);
+            }
+
+            program.endExpansion();
+
+            ctx.success();
+            return true;
+        }
+
+        // symbol pass, then the program is parsed into the ir, label references are resolved in it and it is encoded. with
+        // pKeepUnresolved a label defined in none of the files is left as a relocation for the linker, otherwise it is an error.
+        // pPool may be null
+        bool assemble(SparkThreadPool* pPool, bool pKeepUnresolved, Object::SparkObjectFile* pOut)
+        {
+            // every label offset and register macro is known before encoding so references can point forward
+            vector<Source::SparkSourceLine> executableLines;
+            Cpu::AssemblyLine& line = ctx.currentLine;
+            array<Lexer::SparkLineTokens, SPARK_LEX_RUN_LINES> runTokens;
+            ctx.phases.enter(Stats::PHASE_CLASSIFY);
+
+            for (const auto& segment : program.segments)
+            {
+                ctx.setCurrentFile(sources->path(segment.fileId));
+                span<const Source::SparkSourceLine> segmentLines = sources->segmentLines(segment);
+
+                for (size_t i = 0; i < segmentLines.size(); i++)
+                {
+                    const Source::SparkSourceLine& sourceLine = segmentLines[i];
+
+                    line.assemblerLineNumber = sourceLine.lineIndex + 1;
+                    line.rawLineContents = sources->lineText(sourceLine);
+                    lexLine(&ctx.phases, sources, segmentLines, i, runTokens.data(), &line.tokens);
+
+                    if (line.tokens.empty())
+                    {
+                        continue;
+                    }
+
+                    switch (Analysis::getCurrentLineType(&ctx))
+                    {
+                    case Analysis::EMPTY:
+                        {
+                        }
+                        break;
+
+                    case Analysis::EXECUTABLE:
+                        {
+                            ctx.incrementCpuLineNumber();
+                            executableLines.push_back(sourceLine);
+                        }
+                        break;
+
+                    case Analysis::LABEL:
+                        {
+                            Analysis::parseLabelFromCurrentAssemblyLine(&ctx);
+
+                            if (ctx.isError())
+                            {
+                                return fail();
+                            }
+                        }
+                        break;
+
+                    case Analysis::REGISTER_MACRO:
+                        {
+                            Analysis::parseRegisterMacroFromCurrentLine(&ctx);
+
+                            if (ctx.isError())
+                            {
+                                return fail();
+                            }
+                        }
+                        break;
+
+                    case Analysis::DIRECTIVE:
+                        {
+                            ctx.error(format("Unknown directive '{0}'.\n", line.tokens[0].text));
+                            return fail();
+                        }
+
+                    default:
+                        {
+                            diagnostics.push_back({ctx.currentFile.string(), line.assemblerLineNumber, string(line.rawLineContents), "Could not determine the line type, the line is ignored.\n", DIAGNOSTIC_WARNING});
+                        }
+                        break;
+                    }
+                }
+            }
+
+            // every executable line owns one slot of the output
+            pOut->words.assign(executableLines.size(), 0);
+            pOut->symbols.clear();
+            pOut->relocations.clear();
+
+            IR::SparkProgramIR ir;
+            SparkDiagnostic parseError;
+
+            // the workers time the parse, this thread only waits for them
+            ctx.phases.enter(Stats::PHASE_IDLE);
+
+            if (!parseLines(&ctx, sources, executableLines, &ir, pPool, &parseError))
+            {
+                diagnostics.push_back(std::move(parseError));
+                return false;
+            }
+
+            // the encode kernel is timed as a whole on this thread, including its parallel blocks
+            ctx.phases.enter(Stats::PHASE_ENCODE);
+
+            for (const auto& fixup : ctx.fixups)
+            {
+                if (pKeepUnresolved && !ctx.findLabel(fixup.labelName))
+                {
+                    pOut->relocations.push_back(fixup);
+                    continue;
+                }
+
+                IR::resolveFixup(&ctx, fixup, &ir);
+
+                if (ctx.isError())
+                {
+                    diagnostics.push_back({fixup.file, fixup.lineNumber, fixup.lineContents, ctx.getReason()});
+                    return false;
+                }
+            }
+
+            IR::encodeProgram(ir, pOut->words.data(), pPool, ctx.trace);
+
+            for (size_t i = 0; i < ctx.labels.count(); i++)
+            {
+                pOut->symbols.push_back(*ctx.labels.at(i));
+            }
+
+            ctx.success();
+            return true;
+        }
+    } SparkAssemblyUnit;
+}
@@ -1,4 +1,4 @@
-#ifndef _CRT_SECURE_NO_WARNINGS
+﻿#ifndef _CRT_SECURE_NO_WARNINGS
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
@@ -8,22 +8,118 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <format>
 #include <print>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 
 #include <assembler.hpp>
+#include <unit.hpp>
+#include <cache.hpp>
+#include <object.hpp>
+#include <output.hpp>
+#include <server.hpp>
+#include <stats.hpp>
+#include <disassembler.hpp>
+#include <endian.hpp>
 #include <cpu.hpp>
 #include <log.hpp>
 
 #define ASSEMBLERERR_EX(file, lineNumber, lineContents, reason) LOGERR("Assembler failed on file '{0}', line {1}: {2}'{3}' - {4}{5}\n", file, lineNumber, CLR_FRYEL, lineContents, CLR_FBRED, reason)
-#define ASSEMBLERERR(ctx) ASSEMBLERERR_EX(ctx->currentFile.string(), assemblerLineNumber, *ctx->currentLine->rawLineContentsPtr, ctx->getReason())
+#define ASSEMBLERERR(diagnostic) ASSEMBLERERR_EX(diagnostic.file, diagnostic.lineNumber, diagnostic.lineContents, diagnostic.reason)
+#define ASSEMBLERWRN(diagnostic) LOGWRN("Assembler warning on file '{0}', line {1}: {2}'{3}' - {4}{5}\n", diagnostic.file, diagnostic.lineNumber, CLR_FRYEL, diagnostic.lineContents, CLR_FBRED, diagnostic.reason)
 #define ASSEMBLERDBG(lineNumber, lineContents, reason) LOGERR("Ignoring line {0}: {1}'{2}' - {3}{4}\n", lineNumber, CLR_FRYEL, lineContents, CLR_FBRED, reason)
 #define ASSEMBLERERR_NOT_PROVIDED(argName, shortOption, longOption) LOGERR(##argName " was not provided, provide it using '-" ##shortOption "' or '--" ##longOption "'.\n")
 
-#define DISASSEMBLERERR_EX(fileOffset, ctx) LOGERR("Disassembler failed on file offset 0x{0:X} - {1}{2}\n", fileOffset, CLR_FBRED, ctx->getReason())
+#define LINKERERR(ctx) LOGERR("Linker failed - {0}{1}\n", CLR_FBRED, ctx->getReason())
+
+#define DISASSEMBLERERR_EX(fileOffset, reason) LOGERR("Disassembler failed on file offset 0x{0:X} - {1}{2}\n", fileOffset, CLR_FBRED, reason)
+
+// every allocation of the process is counted while a run with '--stats' is in progress. the array and nothrow forms end up in
+// the plain or aligned form below. pAlignment 0 is the default alignment of malloc
+void* allocateCounted(size_t pSize, size_t pAlignment)
+{
+    if (SPARK::Stats::gAllocationTracking.load(memory_order_relaxed) > 0)
+    {
+        SPARK::Stats::gAllocationCount.fetch_add(1, memory_order_relaxed);
+    }
+
+    size_t size = pSize > 0 ? pSize : 1;
+
+    while (true)
+    {
+        void* allocation;
+
+        if (pAlignment == 0)
+        {
+            allocation = malloc(size);
+        }
+        else
+        {
+#ifdef _WIN32
+            allocation = _aligned_malloc(size, pAlignment);
+#else
+            // aligned_alloc wants a size that is a multiple of the alignment
+            allocation = aligned_alloc(pAlignment, (size + pAlignment - 1) & ~(pAlignment - 1));
+#endif
+        }
+
+        if (allocation)
+        {
+            return allocation;
+        }
+
+        new_handler handler = get_new_handler();
+        if (!handler)
+        {
+            throw bad_alloc();
+        }
+
+        handler();
+    }
+}
+
+void freeAligned(void* pAllocation)
+{
+#ifdef _WIN32
+    _aligned_free(pAllocation);
+#else
+    free(pAllocation);
+#endif
+}
+
+void* operator new(size_t pSize)
+{
+    return allocateCounted(pSize, 0);
+}
+
+void* operator new(size_t pSize, align_val_t pAlignment)
+{
+    return allocateCounted(pSize, static_cast<size_t>(pAlignment));
+}
+
+void operator delete(void* pAllocation) noexcept
+{
+    free(pAllocation);
+}
+
+void operator delete(void* pAllocation, size_t) noexcept
+{
+    free(pAllocation);
+}
+
+void operator delete(void* pAllocation, align_val_t) noexcept
+{
+    freeAligned(pAllocation);
+}
+
+void operator delete(void* pAllocation, size_t, align_val_t) noexcept
+{
+    freeAligned(pAllocation);
+}
 
 enum EReturnCode
 {
@@ -36,7 +132,9 @@ enum ESparkAssemblerOperation
     UNRECOGNIZEDASSEMBLEROP = -2,
     INVASSEMBLEROP,
     ASSEMBLE,
-    DISASSEMBLE
+    DISASSEMBLE,
+    ASSEMBLE_OBJECT,
+    LINK
 };
 
 ESparkAssemblerOperation argToAssemblerOperation(const string& pArg)
@@ -51,33 +149,381 @@ ESparkAssemblerOperation argToAssemblerOperation(const string& pArg)
         return DISASSEMBLE;
     }
 
+    if (pArg == "OBJECT" || pArg == "O")
+    {
+        return ASSEMBLE_OBJECT;
+    }
+
+    if (pArg == "LINK" || pArg == "L")
+    {
+        return LINK;
+    }
+
     return UNRECOGNIZEDASSEMBLEROP;
 }
 
-int main(int pArgumentCount, char* pArguments[])
+// one input and output file pair. the outcome is recorded instead of printed so batch jobs can be reported in manifest order
+typedef struct SparkJob
+{
+    string inputFile;
+    string outputFile;
+
+    bool succeeded = false;
+    bool cached = false;
+    vector<SPARK::Assembler::SparkDiagnostic> diagnostics;
+
+    // a failure that does not belong to a source line
+    string error;
+    string warning;
+
+    bool disassemblyFailed = false;
+    size_t failedOffset = 0;
+
+    SparkJob() = default;
+
+    SparkJob(const string& pInputFile, const string& pOutputFile)
+    {
+        inputFile = pInputFile;
+        outputFile = pOutputFile;
+    }
+} SparkJob;
+
+// an object keeps its symbols and unresolved relocations, a plain image is only the words. objects are always in host byte
+// order, pEndianness is applied when they are linked
+bool writeAssembledOutput(ESparkAssemblerOperation pOperation, const string& pPath, const SPARK::Assembler::Object::SparkObjectFile& pAssembled, SPARK::ESparkEndianness pEndianness, string* pOutError)
+{
+    if (pOperation != ASSEMBLE_OBJECT)
+    {
+        return SPARK::writeImageFile(pPath, pAssembled.words, pEndianness, pOutError);
+    }
+
+    if (!SPARK::Assembler::Object::writeObjectFile(pPath, pAssembled))
+    {
+        *pOutError = format("Error writing object file '{0}'.\n", pPath);
+        return false;
+    }
+
+    return true;
+}
+
+void printDiagnostics(const vector<SPARK::Assembler::SparkDiagnostic>& pDiagnostics)
+{
+    for (const auto& diagnostic : pDiagnostics)
+    {
+        if (diagnostic.severity == SPARK::Assembler::DIAGNOSTIC_WARNING)
+        {
+            ASSEMBLERWRN(diagnostic);
+        }
+        else
+        {
+            ASSEMBLERERR(diagnostic);
+        }
+    }
+}
+
+void printJob(const SparkJob& pJob)
+{
+    printDiagnostics(pJob.diagnostics);
+
+    if (!pJob.warning.empty())
+    {
+        LOGWRN("{0}", pJob.warning);
+    }
+
+    if (pJob.disassemblyFailed)
+    {
+        DISASSEMBLERERR_EX(pJob.failedOffset, pJob.error);
+    }
+    else if (!pJob.error.empty())
+    {
+        LOGERR("{0}", pJob.error);
+    }
+}
+
+// pSources, pPool, pMemoryCache, pStats and pTrace may be shared with other jobs running at the same time, pMemoryCache, pStats and
+// pTrace may be null
+void assembleJob(ESparkAssemblerOperation pOperation, SparkJob* pJob, SPARK::Assembler::Source::SparkSourceManager* pSources, SPARK::SparkThreadPool* pPool,
+                 const filesystem::path& pWorkingDirectory, SPARK::Assembler::Cache::SparkMemoryCache* pMemoryCache, const string& pCacheDirectory, SPARK::ESparkEndianness pEndianness,
+                 SPARK::Stats::SparkStats* pStats, SPARK::Trace::SparkTraceRecorder* pTrace)
+{
+    SPARK::Trace::SparkTraceScope span(pTrace, "job", pJob->inputFile);
+
+    uint32_t rootFileId = pSources->load(pJob->inputFile);
+
+    if (rootFileId == SPARK::Assembler::Source::SPARK_INVALID_FILE_ID)
+    {
+        pJob->error = format("Error opening file '{0}'\n.", pJob->inputFile);
+        return;
+    }
+
+    SPARK::Assembler::SparkAssemblyUnit unit(pSources, rootFileId);
+    unit.ctx.workingDirectory = pWorkingDirectory;
+    unit.ctx.attachInstrumentation(pStats, pTrace);
+
+    if (pStats)
+    {
+        pStats->files++;
+    }
+
+    if (!unit.expand(true))
+    {
+        pJob->diagnostics = std::move(unit.diagnostics);
+        return;
+    }
+
+    if (pStats)
+    {
+        pStats->sourceLines += unit.program.lineCount;
+    }
+
+    // an unchanged program skips lexing and encoding entirely
+    uint64_t cacheKey = 0;
+    bool cacheEnabled = pMemoryCache || !pCacheDirectory.empty();
+
+    if (cacheEnabled)
+    {
+        unit.ctx.phases.enter(SPARK::Stats::PHASE_CACHE);
+        cacheKey = SPARK::Assembler::Cache::computeProgramKey(pSources, unit.program);
+
+        SPARK::Assembler::Cache::SparkCachedAssembly cached;
+        bool found = pMemoryCache && pMemoryCache->find(cacheKey, &cached);
+
+        if (!found && !pCacheDirectory.empty() && SPARK::Assembler::Cache::loadCachedAssembly(pCacheDirectory, cacheKey, &cached))
+        {
+            found = true;
+
+            if (pMemoryCache)
+            {
+                pMemoryCache->store(cacheKey, cached);
+            }
+        }
+
+        if (found)
+        {
+            // only fully resolved programs are cached, so the object has no relocations
+            SPARK::Assembler::Object::SparkObjectFile assembled{std::move(cached.words), std::move(cached.labels), {}};
+
+            if (pStats)
+            {
+                pStats->words += assembled.words.size();
+            }
+
+            unit.ctx.phases.enter(SPARK::Stats::PHASE_WRITE);
+            pJob->cached = true;
+            pJob->succeeded = writeAssembledOutput(pOperation, pJob->outputFile, assembled, pEndianness, &pJob->error);
+            return;
+        }
+    }
+
+    SPARK::Assembler::Object::SparkObjectFile assembled;
+    bool assembledUnit = unit.assemble(pPool, pOperation == ASSEMBLE_OBJECT, &assembled);
+
+    pJob->diagnostics = std::move(unit.diagnostics);
+
+    if (!assembledUnit)
+    {
+        return;
+    }
+
+    if (pStats)
+    {
+        pStats->words += assembled.words.size();
+    }
+
+    unit.ctx.phases.enter(SPARK::Stats::PHASE_WRITE);
+
+    if (!writeAssembledOutput(pOperation, pJob->outputFile, assembled, pEndianness, &pJob->error))
+    {
+        return;
+    }
+
+    if (cacheEnabled && assembled.relocations.empty())
+    {
+        unit.ctx.phases.enter(SPARK::Stats::PHASE_CACHE);
+
+        SPARK::Assembler::Cache::SparkCachedAssembly cacheEntry{std::move(assembled.words), std::move(assembled.symbols)};
+
+        if (pMemoryCache)
+        {
+            pMemoryCache->store(cacheKey, cacheEntry);
+        }
+
+        if (!pCacheDirectory.empty() && !SPARK::Assembler::Cache::storeCachedAssembly(pCacheDirectory, cacheKey, cacheEntry))
+        {
+            pJob->warning = format("Could not write the assembly cache entry to '{0}'.\n", pCacheDirectory);
+        }
+    }
+
+    pJob->succeeded = true;
+}
+
+// pStats and pTrace may be null
+void disassembleJob(SparkJob* pJob, SPARK::SparkThreadPool* pPool, bool pHexdump, SPARK::ESparkEndianness pEndianness, SPARK::Stats::SparkStats* pStats, SPARK::Trace::SparkTraceRecorder* pTrace)
+{
+    SPARK::Trace::SparkTraceScope span(pTrace, "job", pJob->inputFile);
+
+    FILE* input = fopen(pJob->inputFile.c_str(), "rb");
+    if (!input)
+    {
+        pJob->error = format("Error opening file '{0}'.\n", pJob->inputFile);
+        return;
+    }
+
+    // a failed or interrupted disassembly never replaces an existing listing
+    SPARK::SparkOutputFile listing(pJob->outputFile);
+
+    FILE* output = fopen(listing.writePath().c_str(), "w");
+    if (!output)
+    {
+        pJob->error = format("Error opening file '{0}'.\n", pJob->outputFile);
+        fclose(input);
+        return;
+    }
+
+    SPARK::Cpu::SparkAssemblerContext ctx;
+    ctx.attachInstrumentation(pStats, pTrace);
+    bool disassembled;
+
+    if (pStats)
+    {
+        pStats->files++;
+    }
+
+    {
+        SPARK::SparkTextEmitter emitter(output);
+        disassembled = SPARK::Assembler::Disassembly::disassembleStream(&ctx, input, &emitter, pHexdump, pEndianness, pPool, &pJob->failedOffset);
+    }
+
+    ctx.phases.enter(SPARK::Stats::PHASE_WRITE);
+
+    fclose(input);
+    bool written = listing.close(output);
+
+    if (!disassembled)
+    {
+        pJob->disassemblyFailed = true;
+        pJob->error = ctx.getReason();
+        return;
+    }
+
+    if (!written || !listing.commit())
+    {
+        pJob->error = format("Error writing file '{0}'.\n", pJob->outputFile);
+        return;
+    }
+
+    pJob->succeeded = true;
+}
+
+// phase times are summed over every thread that worked on the phase, so with '-j' they can add up to more than the wall time
+void printStats(const SPARK::Stats::SparkStats& pStats)
+{
+    LOGINF("Stats: {0} files, {1} source lines, {2} words in {3:.3f} ms\n", pStats.files.load(), pStats.sourceLines.load(), pStats.words.load(), SPARK::Stats::milliseconds(pStats.wallNanoseconds));
+
+    for (size_t i = 0; i < SPARK::Stats::PHASE_COUNT; i++)
+    {
+        uint64_t nanoseconds = pStats.phaseNanoseconds[i].load();
+        if (nanoseconds > 0)
+        {
+            LOGINF("  {0:<20} {1:>10.3f} ms\n", SPARK::Stats::gPhaseNames[i], SPARK::Stats::milliseconds(nanoseconds));
+        }
+    }
+
+    LOGINF("  {0:.0f} lines/s, {1:.0f} words/s\n", SPARK::Stats::perSecond(pStats.sourceLines, pStats.wallNanoseconds), SPARK::Stats::perSecond(pStats.words, pStats.wallNanoseconds));
+    LOGINF("  {0} includes, include cache hits {1} of {2} ({3:.1f}%)\n", pStats.includeFiles.load(), pStats.includeCacheHits.load(), pStats.includeLookups.load(), SPARK::Stats::includeCacheHitRate(pStats) * 100.0);
+    LOGINF("  peak RSS {0:.1f} MiB, {1} allocations\n", static_cast<double>(pStats.peakResidentBytes) / (1 << 20), pStats.allocations);
+}
+
+// paths from a forwarded command line are relative to the directory of the client, not the one of the server
+string resolveArgumentPath(const filesystem::path& pWorkingDirectory, const string& pPath)
+{
+    if (pPath.empty())
+    {
+        return pPath;
+    }
+
+    return (pWorkingDirectory / pPath).string();
+}
+
+// one '<input> <output>' pair per line, blank lines and lines starting with '#' are skipped
+bool readBatchManifest(const string& pPath, const filesystem::path& pWorkingDirectory, vector<SparkJob>* pOutJobs)
+{
+    std::ifstream manifest(pPath);
+    if (!manifest.is_open())
+    {
+        LOGERR("Error opening batch manifest '{0}'.\n", pPath);
+        return false;
+    }
+
+    string line;
+    size_t lineNumber = 0;
+
+    while (getline(manifest, line))
+    {
+        lineNumber++;
+
+        std::istringstream fields(line);
+        SparkJob job;
+
+        if (!(fields >> job.inputFile) || job.inputFile[0] == '#')
+        {
+            continue;
+        }
+
+        if (!(fields >> job.outputFile))
+        {
+            LOGERR("Batch manifest '{0}', line {1}: expected '<input> <output>'.\n", pPath, lineNumber);
+            return false;
+        }
+
+        job.inputFile = resolveArgumentPath(pWorkingDirectory, job.inputFile);
+        job.outputFile = resolveArgumentPath(pWorkingDirectory, job.outputFile);
+
+        pOutJobs->push_back(std::move(job));
+    }
+
+    return true;
+}
+
+// the whole command line minus the program name. pServer is null for a local run, otherwise the pool, sources and cache of the
+// server are used and '-j' has no effect
+int runCommandLine(SPARK::Server::SparkServerState* pServer, const vector<string>& pArguments, const filesystem::path& pWorkingDirectory)
 {
     string inputFile, outputFile;
+    vector<string> inputFiles;
+    vector<string> outputFiles;
     ESparkAssemblerOperation operation = INVASSEMBLEROP;
     string stringOperation;
     bool disassemblerHexDumpEnabled = false;
-
-    for (int i = 1; i < pArgumentCount; ++i)
+    size_t threadCount = 1;
+    string cacheDirectory;
+    string batchManifest;
+    string stringEndianness;
+    SPARK::ESparkEndianness endianness = SPARK::ENDIAN_BIG;
+    bool statsEnabled = false;
+    string statsFile;
+    string traceFile;
+
+    for (size_t i = 0; i < pArguments.size(); ++i)
     {
-        string argument = pArguments[i];
+        const string& argument = pArguments[i];
+        string value = i + 1 < pArguments.size() ? pArguments[i + 1] : "";
 
         if (argument == "-i" || argument == "-inputFile")
         {
-            inputFile = pArguments[i + 1];
+            inputFile = resolveArgumentPath(pWorkingDirectory, value);
+            inputFiles.push_back(inputFile);
         }
 
         else if (argument == "-o" || argument == "-outputFile")
         {
-            outputFile = pArguments[i + 1];
+            outputFile = resolveArgumentPath(pWorkingDirectory, value);
+            outputFiles.push_back(outputFile);
         }
 
         else if (argument == "-op" || argument == "--operation")
         {
-            stringOperation = pArguments[i + 1];
+            stringOperation = value;
             operation = argToAssemblerOperation(stringOperation);
         }
 
@@ -85,15 +531,56 @@ int main(int pArgumentCount, char* pArguments[])
         {
             disassemblerHexDumpEnabled = true;
         }
+
+        // 0 uses every hardware thread
+        else if (argument == "-j" || argument == "--jobs")
+        {
+            threadCount = strtoul(value.c_str(), nullptr, 10);
+        }
+
+        else if (argument == "-cache" || argument == "--cache")
+        {
+            cacheDirectory = resolveArgumentPath(pWorkingDirectory, value);
+        }
+
+        else if (argument == "-batch" || argument == "--batch")
+        {
+            batchManifest = resolveArgumentPath(pWorkingDirectory, value);
+        }
+
+        // byte order of images written by ASSEMBLE and LINK and read by DISASSEMBLE
+        else if (argument == "-endian" || argument == "--endian")
+        {
+            stringEndianness = value;
+            endianness = SPARK::argToEndianness(value);
+        }
+
+        // prints where the time of the run went, '--stats-file' also writes it as json
+        else if (argument == "-stats" || argument == "--stats")
+        {
+            statsEnabled = true;
+        }
+
+        else if (argument == "-statsFile" || argument == "--stats-file")
+        {
+            statsEnabled = true;
+            statsFile = resolveArgumentPath(pWorkingDirectory, value);
+        }
+
+        // a timeline of the run that chrome://tracing and perfetto can open
+        else if (argument == "-trace" || argument == "--trace")
+        {
+            traceFile = resolveArgumentPath(pWorkingDirectory, value);
+        }
     }
 
-    if (inputFile.empty())
+    if (inputFile.empty() && batchManifest.empty())
     {
         ASSEMBLERERR_NOT_PROVIDED("Input file", "i", "inputFile");
         return RET_ERR;
     }
 
-    if (outputFile.empty())
+    if (outputFile.empty() && batchManifest.empty())
     {
         ASSEMBLERERR_NOT_PROVIDED("Output file", "o", "outputFile");
         return RET_ERR;
@@ -107,237 +594,256 @@ int main(int pArgumentCount, char* pArguments[])
 
     if (operation == UNRECOGNIZEDASSEMBLEROP)
     {
-        LOGERR("Operation '{0}' is invalid. Valid operations: ASSEMBLE (A), DISASSEMBLE (D)\n", stringOperation);
+        LOGERR("Operation '{0}' is invalid. Valid operations: ASSEMBLE (A), DISASSEMBLE (D), OBJECT (O), LINK (L)\n", stringOperation);
+        return RET_ERR;
+    }
+
+    if (endianness == SPARK::INVENDIAN)
+    {
+        LOGERR("Endianness '{0}' is invalid. Valid values: big, little\n", stringEndianness);
         return RET_ERR;
     }
 
-    SPARK::Assembler::initAssembler();
+    SPARK::Stats::SparkStats runStats;
+    SPARK::Stats::SparkStats* stats = statsEnabled ? &runStats : nullptr;
 
-    auto errCtx = new SPARK::Cpu::SparkAssemblerErrorContext();
-    auto ctx = new SPARK::Cpu::SparkAssemblerContext(errCtx);
+    if (stats)
+    {
+        SPARK::Stats::beginRun(stats);
+    }
 
-    FILE* fp;
+    unique_ptr<SPARK::Trace::SparkTraceRecorder> trace = traceFile.empty() ? nullptr : make_unique<SPARK::Trace::SparkTraceRecorder>();
 
-    switch (operation)
+    // every return from here on goes through this so the stats and the trace cover failed runs as well
+    auto finishRun = [&](int pResult)
     {
-    case ASSEMBLE:
+        if (trace && !SPARK::Trace::writeTraceFile(traceFile, trace.get()))
         {
-            SafeList<Reg> outputFileData;
-            SafeList<string> linesToParse;
+            LOGWRN("Could not write the trace file '{0}'.\n", traceFile);
+        }
 
-            std::ifstream file(inputFile);
+        if (!stats)
+        {
+            return pResult;
+        }
 
-            if (!file.is_open())
-            {
-                LOGERR("Error opening file '{0}'\n.", inputFile);
-                return RET_ERR;
-            }
+        SPARK::Stats::endRun(stats);
+        printStats(*stats);
 
-            std::string lineContentsClean;
-            std::string lineContentsRaw;
+        if (!statsFile.empty() && !SPARK::Stats::writeStatsFile(statsFile, *stats))
+        {
+            LOGWRN("Could not write the stats file '{0}'.\n", statsFile);
+        }
+
+        return pResult;
+    };
+
+    if (operation == LINK)
+    {
+        SPARK::Cpu::SparkAssemblerContext context;
+        SPARK::Cpu::SparkAssemblerContext* ctx = &context;
+        context.attachInstrumentation(stats, trace.get());
+        context.phases.enter(SPARK::Stats::PHASE_READ);
 
-            size_t cpuLineNumber = 0;
-            size_t assemblerLineNumber = 0;
+        vector<SPARK::Assembler::Object::SparkObjectFile> objects(inputFiles.size());
 
-            ctx->setCurrentFile(inputFile);
-            ctx->currentLine = new SPARK::Cpu::AssemblyLine(&cpuLineNumber, &assemblerLineNumber, &lineContentsRaw, &lineContentsClean);
+        for (size_t i = 0; i < inputFiles.size(); i++)
+        {
+            SPARK::Assembler::Object::readObjectFile(ctx, inputFiles[i], &objects[i]);
 
-            while (std::getline(file, lineContentsRaw))
+            if (ctx->isError())
             {
-                lineContentsClean = SPARK::Assembler::Analysis::cleanupAssemblyLine(lineContentsRaw);
-
-                if (SPARK::Assembler::Analysis::currentAssemblyLineHasIncludePath(ctx))
-                {
-                    string path = SPARK::Assembler::Analysis::getIncludePathName(lineContentsClean);
-                    ctx->addIncludePath(path);
-                    if (ctx->isError())
-                    {
-                        LOGERR("Failed to add include path '{0}'.\n", path);
-                        return RET_ERR;
-                    }
-
-                    ctx->incrementAssemblerLineNumber();
-
-                    continue;
-                }
-
-                if (SPARK::Assembler::Analysis::currentAssemblyLineHasInclude(ctx))
-                {
-                    SPARK::Assembler::Analysis::expandCurrentIncludeRecursively(ctx, &linesToParse);
-                    ctx->incrementAssemblerLineNumber();
-                    continue;
-                }
-
-                linesToParse.add(lineContentsRaw);
+                LINKERERR(ctx);
+                context.phases.publish();
+                return finishRun(RET_ERR);
             }
+        }
+
+        vector<Reg> linkedWords;
+        SPARK::Cpu::SparkAssemblerFixup failedRelocation{};
 
-            for (const auto& lineContents : linesToParse)
+        context.phases.enter(SPARK::Stats::PHASE_LINK);
+
+        if (!SPARK::Assembler::Object::linkObjects(ctx, objects, inputFiles, &linkedWords, &failedRelocation))
+        {
+            if (failedRelocation.labelName.empty())
             {
-                ctx->incrementAssemblerLineNumber();
-
-                lineContentsRaw = lineContents;
-                lineContentsClean = SPARK::Assembler::Analysis::cleanupAssemblyLine(lineContentsRaw);
-
-                if (lineContentsClean.empty())
-                {
-                    continue;
-                }
-
-                switch (SPARK::Assembler::Analysis::getCurrentLineType(ctx))
-                {
-                case SPARK::Assembler::Analysis::EMPTY:
-                    {
-                    }
-                    break;
-
-                case SPARK::Assembler::Analysis::EXECUTABLE:
-                    {
-                        ctx->incrementCpuLineNumber();
-
-                        SPARK::Cpu::SparkInstructionInstance* parsed;
-                        SPARK::Assembler::Analysis::parseInstructionFromCurrentAssemblyLine(ctx, &parsed);
-
-                        if (ctx->isError())
-                        {
-                            ASSEMBLERERR(ctx);
-                            return RET_ERR;
-                        }
-
-                        if (ctx->isIgnore())
-                        {
-                            ASSEMBLERDBG(cpuLineNumber, lineContentsRaw, ctx->getReason());
-                            continue;
-                        }
-
-                        Reg operandData = SPARK::Assembler::assembleOperands(&parsed->base->operandLengths, parsed->getOperandValues(), ctx);
-                        if (ctx->isError())
-                        {
-                            ASSEMBLERERR(ctx);
-                            return RET_ERR;
-                        }
-
-                        Reg assembled = parsed->base->opcodeId << 26 | operandData;
-                        delete parsed;
-
-                        // LOGDBG("Assembled line '{0}' --> '{1:08X}'\n", lineContentsRaw, assembled);
-
-                        if (ctx->isError())
-                        {
-                            ASSEMBLERERR(ctx);
-                            return RET_ERR;
-                        }
-
-                        Reg assembledBigEndian = _byteswap_ulong(assembled);
-
-                        if (ctx->isSuccessful())
-                        {
-                            outputFileData.add(assembledBigEndian);
-                        }
-                    }
-                    break;
-
-                case SPARK::Assembler::Analysis::LABEL:
-                    {
-                        SPARK::Assembler::Analysis::parseLabelFromCurrentAssemblyLine(ctx);
-                    }
-                    break;
-
-                case SPARK::Assembler::Analysis::EAssemblyLineType::REGISTER_MACRO:
-                    {
-                        SPARK::Assembler::Analysis::parseRegisterMacroFromCurrentLine(ctx);
-                    }
-                    break;
-
-                default:
-                    {
-                        LOGERR("Could not determine line type from line '{0}'.\n", *ctx->currentLine->rawLineContentsPtr);
-                    }
-                    break;
-                }
+                LINKERERR(ctx);
             }
-            file.close();
+            else
+            {
+                ASSEMBLERERR_EX(failedRelocation.file, failedRelocation.lineNumber, failedRelocation.lineContents, ctx->getReason());
+            }
+            context.phases.publish();
+            return finishRun(RET_ERR);
+        }
 
+        if (stats)
+        {
+            stats->files += objects.size();
+            stats->words += linkedWords.size();
+        }
 
-            fp = fopen(outputFile.c_str(), "w");
-            fwrite(outputFileData.data(), sizeof(Reg), outputFileData.count(), fp);
-            fclose(fp);
+        context.phases.enter(SPARK::Stats::PHASE_WRITE);
 
-            LOGINF("Successfully assembled.\n");
+        string writeError;
+        bool written = SPARK::writeImageFile(outputFile, linkedWords, endianness, &writeError);
 
-            break;
+        // the context outlives the report, so its time is added to the totals by hand
+        context.phases.publish();
+
+        if (!written)
+        {
+            LOGERR("{0}", writeError);
+            return finishRun(RET_ERR);
         }
-    case DISASSEMBLE:
+
+        LOGINF("Successfully linked {0} objects.\n", objects.size());
+        return finishRun(RET_OK);
+    }
+
+    // every other operation runs one job per input file, several '-i'/'-o' pairs or a manifest make a batch
+    vector<SparkJob> jobs;
+
+    if (!batchManifest.empty())
+    {
+        if (!readBatchManifest(batchManifest, pWorkingDirectory, &jobs))
         {
-            string outputFileData;
-            size_t lineNumber = 0;
-            size_t maxLineLength = 0;
-            
-            SafeList<size_t> newlineIndexes;
-            SafeList<size_t> lineLenghts;
-            
-            ifstream file(inputFile, ios_base::in | ios::binary);
+            return finishRun(RET_ERR);
+        }
+    }
+    else if (inputFiles.size() > 1)
+    {
+        if (outputFiles.size() != inputFiles.size())
+        {
+            LOGERR("Every input file needs its own output file, got {0} inputs and {1} outputs.\n", inputFiles.size(), outputFiles.size());
+            return finishRun(RET_ERR);
+        }
 
-            size_t inBufferInstructionCount = filesystem::file_size(inputFile) / sizeof(Reg);
-            SafeList<Reg> inBuffer(inBufferInstructionCount);
+        for (size_t i = 0; i < inputFiles.size(); i++)
+        {
+            jobs.emplace_back(inputFiles[i], outputFiles[i]);
+        }
+    }
+    else
+    {
+        jobs.emplace_back(inputFile, outputFile);
+    }
 
-            file.read(inBuffer.data(), inBufferInstructionCount * sizeof(Reg));
+    // files share the pool, the loaded sources and include resolution. a job that fails does not stop the others
+    unique_ptr<SPARK::SparkThreadPool> localPool;
+    unique_ptr<SPARK::Assembler::Source::SparkSourceManager> localSources;
 
-            for (size_t i = 0; i < inBufferInstructionCount; i++)
-            {
-                lineNumber++;
-
-                Reg instruction = inBuffer[i];
-                instruction = _byteswap_ulong(instruction);
-
-                string disassembled = SPARK::Assembler::disasemble(instruction, ctx);
-                if (disassembled.length() > maxLineLength)
-                {
-                    maxLineLength = disassembled.length();
-                }
-
-                if (ctx->isSuccessful())
-                {
-                    outputFileData += disassembled + '\n';
-
-                    lineLenghts.add(disassembled.length());
-                    newlineIndexes.add(outputFileData.size() - 1);
-                }
-
-                if (ctx->isError())
-                {
-                    DISASSEMBLERERR_EX(i * 4, ctx);
-                    return RET_ERR;
-                }
-            }
+    if (!pServer)
+    {
+        localPool = make_unique<SPARK::SparkThreadPool>(threadCount);
+        localSources = make_unique<SPARK::Assembler::Source::SparkSourceManager>();
+    }
 
-            if (disassemblerHexDumpEnabled)
-            {
-                size_t i = 0;
-                size_t offset = 0;
-                for (size_t newLineIndex : newlineIndexes)
-                {
-                    string filler(maxLineLength - lineLenghts[i], ' ');
-                    Reg instruction = _byteswap_ulong(inBuffer[i]);
-                    
-                    string comment = format("{0} ; {1:08X}\t{2:08X}", filler, instruction, i * 4);
-                    outputFileData.insert(newLineIndex + offset, comment);
-                    
-                    offset += comment.length();
-                    
-                    i++;
-                }
-            }
+    SPARK::SparkThreadPool* pool = pServer ? pServer->pool : localPool.get();
+    SPARK::Assembler::Source::SparkSourceManager* sources = pServer ? pServer->sources : localSources.get();
+    SPARK::Assembler::Cache::SparkMemoryCache* memoryCache = pServer ? pServer->memoryCache : nullptr;
+
+    pool->parallelFor(jobs.size(), [&](size_t pJobIdx)
+    {
+        if (operation == DISASSEMBLE)
+        {
+            disassembleJob(&jobs[pJobIdx], pool, disassemblerHexDumpEnabled, endianness, stats, trace.get());
+        }
+        else
+        {
+            assembleJob(operation, &jobs[pJobIdx], sources, pool, pWorkingDirectory, memoryCache, cacheDirectory, endianness, stats, trace.get());
+        }
+    });
+
+    size_t failedJobs = 0;
 
-            fp = fopen(outputFile.c_str(), "w");
-            fwrite(outputFileData.data(), 1, outputFileData.size(), fp);
-            fclose(fp);
+    for (const SparkJob& job : jobs)
+    {
+        printJob(job);
 
-            LOGINF("Successfully disassembled.\n");
+        if (!job.succeeded)
+        {
+            failedJobs++;
+        }
+    }
 
+    if (jobs.size() > 1)
+    {
+        if (failedJobs > 0)
+        {
+            LOGERR("{0} of {1} files failed.\n", failedJobs, jobs.size());
+            return finishRun(RET_ERR);
+        }
+
+        LOGINF("Successfully processed {0} files.\n", jobs.size());
+        return finishRun(RET_OK);
+    }
+
+    if (failedJobs > 0)
+    {
+        return finishRun(RET_ERR);
+    }
+
+    if (operation == DISASSEMBLE)
+    {
+        LOGINF("Successfully disassembled.\n");
+    }
+    else if (jobs[0].cached)
+    {
+        LOGINF("Successfully assembled (cached).\n");
+    }
+    else
+    {
+        LOGINF("Successfully assembled.\n");
+    }
+
+    return finishRun(RET_OK);
+}
+
+// '--serve <socket>' keeps the tables, loaded sources and assembled programs warm and runs the command lines that
+// '--client <socket>' forwards to it
+int main(int pArgumentCount, char* pArguments[])
+{
+    vector<string> arguments(pArguments + 1, pArguments + pArgumentCount);
+    string servePath, clientPath;
+    size_t threadCount = 1;
+
+    for (size_t i = 0; i + 1 < arguments.size(); ++i)
+    {
+        if (arguments[i] == "-serve" || arguments[i] == "--serve")
+        {
+            servePath = arguments[i + 1];
+        }
+
+        else if (arguments[i] == "-client" || arguments[i] == "--client")
+        {
+            clientPath = arguments[i + 1];
+            arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
             break;
         }
-    default: return RET_ERR;
+
+        else if (arguments[i] == "-j" || arguments[i] == "--jobs")
+        {
+            threadCount = strtoul(arguments[i + 1].c_str(), nullptr, 10);
+        }
+    }
+
+    if (!clientPath.empty())
+    {
+        return SPARK::Server::runClient(clientPath, arguments);
     }
 
-    return 0;
+    if (servePath.empty())
+    {
+        return runCommandLine(nullptr, arguments, {});
+    }
+
+    SPARK::SparkThreadPool pool(threadCount);
+    SPARK::Assembler::Source::SparkSourceManager sources;
+    SPARK::Assembler::Cache::SparkMemoryCache memoryCache;
+
+    SPARK::Server::SparkServerState state{&pool, &sources, &memoryCache, runCommandLine};
+
+    return SPARK::Server::serve(servePath, &state) ? RET_OK : RET_ERR;
 }
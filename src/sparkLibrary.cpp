@@ -0,0 +1,112 @@
+﻿#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <format>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <sparkLibrary.hpp>
+
+#include <assembler.hpp>
+#include <cpu.hpp>
+#include <disassembler.hpp>
+#include <emitter.hpp>
+#include <object.hpp>
+#include <source.hpp>
+#include <threadPool.hpp>
+#include <unit.hpp>
+
+namespace SPARK::Library
+{
+    // snippets are small, a large staging buffer would cost more to allocate than the listing takes to format
+    constexpr size_t SPARK_LIBRARY_EMITTER_SIZE = 1 << 12;
+
+    bool assemble(std::string_view pSource, std::span<uint32_t> pOutWords, const SparkAssembleOptions& pOptions, SparkAssembleResult* pOutResult)
+    {
+        pOutResult->success = false;
+        pOutResult->wordCount = 0;
+        pOutResult->diagnostics.clear();
+        pOutResult->symbols.clear();
+
+        Assembler::Source::SparkSourceManager sources;
+        Assembler::SparkAssemblyUnit unit(&sources, sources.addMemoryFile(pOptions.name, pSource));
+        Assembler::Object::SparkObjectFile assembled;
+
+        bool assembledUnit = unit.expand(false);
+
+        // a snippet on the calling thread does not pay for a pool
+        if (assembledUnit && pOptions.threadCount == 1)
+        {
+            assembledUnit = unit.assemble(nullptr, false, &assembled);
+        }
+        else if (assembledUnit)
+        {
+            SparkThreadPool pool(pOptions.threadCount);
+            assembledUnit = unit.assemble(&pool, false, &assembled);
+        }
+
+        for (const auto& diagnostic : unit.diagnostics)
+        {
+            pOutResult->diagnostics.push_back({diagnostic.file, diagnostic.lineNumber, diagnostic.lineContents, diagnostic.reason, diagnostic.severity == Assembler::DIAGNOSTIC_WARNING});
+        }
+
+        if (!assembledUnit)
+        {
+            return false;
+        }
+
+        pOutResult->wordCount = assembled.words.size();
+
+        for (const auto& symbol : assembled.symbols)
+        {
+            pOutResult->symbols.push_back({symbol.name, symbol.offset});
+        }
+
+        if (assembled.words.size() > pOutWords.size())
+        {
+            pOutResult->diagnostics.push_back({pOptions.name, 0, "", format("The program needs {0} words but the output buffer only holds {1}.\n", assembled.words.size(), pOutWords.size()), false});
+            return false;
+        }
+
+        copy(assembled.words.begin(), assembled.words.end(), pOutWords.begin());
+
+        pOutResult->success = true;
+        return true;
+    }
+
+    bool disassemble(std::span<const uint32_t> pWords, std::span<char> pOutText, const SparkDisassembleOptions& pOptions, SparkDisassembleResult* pOutResult)
+    {
+        pOutResult->success = false;
+        pOutResult->textLength = 0;
+        pOutResult->failedIndex = 0;
+        pOutResult->reason.clear();
+
+        Cpu::SparkAssemblerContext ctx;
+        bool disassembled;
+
+        {
+            SparkTextEmitter emitter(pOutText, SPARK_LIBRARY_EMITTER_SIZE);
+            disassembled = Assembler::Disassembly::disassembleWords(&ctx, pWords, &emitter, pOptions.hexdump, &pOutResult->failedIndex);
+            emitter.flush();
+
+            pOutResult->textLength = emitter.totalLength();
+        }
+
+        if (!disassembled)
+        {
+            pOutResult->reason = ctx.getReason();
+            return false;
+        }
+
+        if (pOutResult->textLength > pOutText.size())
+        {
+            pOutResult->reason = format("The listing needs {0} characters but the output buffer only holds {1}.\n", pOutResult->textLength, pOutText.size());
+            return false;
+        }
+
+        pOutResult->success = true;
+        return true;
+    }
+}